@@ -86,6 +86,11 @@ void DataInfo::setKeyVersion(const std::string &v)
     keyVersion=v;
 }
 
+std::size_t DataInfo::memoryUsage() const
+{
+    return sizeof(DataInfo) + key.size() + keyVersion.size() + d.capacity();
+}
+
 const std::string& DataInfo::data() const
 {
     return d;
@@ -38,6 +38,7 @@ public:
     const std::string& getKey() const;
     const std::string& getKeyVersion() const;
     void setKeyVersion(const std::string& v);
+    std::size_t memoryUsage() const;
 
 public:
     explicit DataInfo(const std::string &key, const std::string &keyVersion, const std::string &data);
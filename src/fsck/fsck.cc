@@ -15,7 +15,6 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "main.h"
-using com::seagate::kinetic::client::proto::Command_Algorithm_SHA1;
 
 static int scan_direntries(const char *user_path, const std::shared_ptr<MetadataInfo> &dir, std::string &entry)
 {
@@ -98,7 +97,7 @@ static int recover_rename(const char *dir_path, const std::shared_ptr<MetadataIn
     if(origin_mdi->getMD().inode_number() == 0){
         assert(target_mdi->getMD().inode_number());
         assert(!S_ISDIR( target_mdi->getMD().mode() ));
-        KineticRecord record(target_mdi->getMD().SerializeAsString(), target_mdi->getKeyVersion(), "", Command_Algorithm_SHA1);
+        KineticRecord record = util::serialized_record(target_mdi->getMD(), target_mdi->getKeyVersion());
         KineticStatus status = PRIV->kinetic->Put(origin_mdi->getSystemPath(), "", WriteMode::REQUIRE_SAME_VERSION, record);
         if(!status.ok()) return -EIO;
     }
@@ -110,7 +109,7 @@ static int recover_rename(const char *dir_path, const std::shared_ptr<MetadataIn
     }
 
     /* origin direntry might not exist -> create */
-    int err = create_directory_entry(origin_parent_mdi, util::path_to_filename(origin) );
+    int err = create_directory_entry(origin_parent_mdi, util::path_to_filename(origin), target_mdi->getMD().inode_number() ? target_mdi : origin_mdi);
     if(err && err != -EEXIST) return err;
 
     /* delete recovery direntry */
@@ -122,7 +121,7 @@ static int recover_rename(const char *dir_path, const std::shared_ptr<MetadataIn
 int fsck_directory(const char* user_path, const std::shared_ptr<MetadataInfo> &mdi)
 {
     assert(S_ISDIR(mdi->getMD().mode()));
-    assert(fuse_get_context()->uid == 0);
+    assert(hflat_get_context()->uid == 0);
     std::string entry;
 
     while ( int err = scan_direntries(user_path, mdi, entry) )
@@ -18,7 +18,9 @@
 #define hflat_FUSUOPS_H_
 
 /* directory */
+int hflat_opendir(const char *user_path, struct fuse_file_info *fi);
 int hflat_readdir(const char *user_path, void *buffer, fuse_fill_dir_t filldir, off_t offset, struct fuse_file_info *fi);
+int hflat_releasedir(const char *user_path, struct fuse_file_info *fi);
 int hflat_mkdir(const char *user_path, mode_t mode);
 int hflat_rmdir(const char *user_path);
 
@@ -69,5 +71,9 @@ int hflat_fsyncdir(const char *user_path, int datasync, struct fuse_file_info *f
 int hflat_flush(const char *user_path, struct fuse_file_info *fi);
 
 /* main */
+void *hflat_init(struct fuse_conn_info *conn);
 void hflat_destroy(void *priv);
+
+/* low-level frontend */
+int hflat_lowlevel_main(int argc, char *argv[]);
 #endif
@@ -20,6 +20,21 @@
 #include <sys/param.h>
 #include "fuseops.h"
 
+void metadata_to_stat(const std::shared_ptr<MetadataInfo> &mdi, struct stat *attr)
+{
+    attr->st_ino    = mdi->getMD().inode_number();
+    attr->st_atime  = mdi->getMD().atime();
+    attr->st_mtime  = mdi->getMD().mtime();
+    attr->st_ctime  = mdi->getMD().ctime();
+    attr->st_uid    = mdi->getMD().uid();
+    attr->st_gid    = mdi->getMD().gid();
+    attr->st_mode   = mdi->getMD().mode();
+    attr->st_nlink  = mdi->getMD().link_count();
+    attr->st_size   = mdi->getMD().size();
+    attr->st_blocks = mdi->getMD().blocks();
+    attr->st_blksize= PRIV->blocksize;
+}
+
 /** Get file attributes.
  *
  * Similar to stat().  The 'st_dev' and 'st_blksize' fields are
@@ -35,17 +50,7 @@ int hflat_getattr(const char *user_path, struct stat *attr)
     if(mdi->getDirtyData() && mdi->getDirtyData()->hasUpdates())
         hflat_fsync(user_path, 0, nullptr);
 
-    attr->st_ino    = mdi->getMD().inode_number();
-    attr->st_atime  = mdi->getMD().atime();
-    attr->st_mtime  = mdi->getMD().mtime();
-    attr->st_ctime  = mdi->getMD().ctime();
-    attr->st_uid    = mdi->getMD().uid();
-    attr->st_gid    = mdi->getMD().gid();
-    attr->st_mode   = mdi->getMD().mode();
-    attr->st_nlink  = mdi->getMD().link_count();
-    attr->st_size   = mdi->getMD().size();
-    attr->st_blocks = mdi->getMD().blocks();
-    attr->st_blksize= PRIV->blocksize;
+    metadata_to_stat(mdi, attr);
     return 0;
 }
 
@@ -108,7 +113,7 @@ int hflat_statfs(const char *user_path, struct statvfs *s)
     s->f_bfree  = s->f_bavail;
 
     s->f_namemax = NAME_MAX; /* Max file name length */
-    s->f_files   = static_cast<fsfilcnt_t>(PRIV->inum_base) + PRIV->inum_counter; /* Total inodes */
+    s->f_files   = static_cast<fsfilcnt_t>(PRIV->inodes.position()); /* Total inodes */
     s->f_ffree   = std::numeric_limits<std::uint16_t>::max(); /* Free inodes */
     return 0;
 }
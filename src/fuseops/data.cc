@@ -19,17 +19,17 @@
 #include "kinetic_helper.h"
 #include "fuseops.h"
 #include <algorithm>
+#include <thread>
 
-enum class rw {READ, WRITE};
-static int do_rw(char *buf, size_t size, off_t offset, const std::shared_ptr<MetadataInfo> &mdi, std::shared_ptr<DataInfo> &di, rw mode)
+/* Obtain a data block from the data cache or the flat namespace. Blocks of growing files are not read in. */
+static int cached_data(const std::string &key, std::shared_ptr<DataInfo> &di, bool growing)
 {
-    int blocknum     = offset / PRIV->blocksize;
-    std::string key  = std::to_string(mdi->getMD().inode_number()) + "_" + std::to_string(blocknum);
-
     while(PRIV->data_cache.get(key, di) == false){
           if(PRIV->data_cache.block(key)){
-            /* Don't GET if the file is growing. */
-            if(mode == rw::WRITE && offset+size > mdi->getMD().size())
+            /* An expired data block is revived if its version didn't change, saving a full block transfer. */
+            if(PRIV->data_cache.getExpired(key, di) && data_unchanged(di) && PRIV->data_cache.revive(key))
+                break;
+            if(growing)
                 di.reset(new DataInfo(key, std::string(""), std::string("")));
             else if (int err = get_data(key, di)){
                 PRIV->data_cache.invalidate(key);
@@ -38,9 +38,50 @@ static int do_rw(char *buf, size_t size, off_t offset, const std::shared_ptr<Met
             REQ_TRUE(PRIV->data_cache.add(key, di));
           }
     }
+    return 0;
+}
 
+/* Sequential reads using a file handle prefetch the following data block in the background. */
+static void read_ahead(OpenFile &file, off_t offset, size_t size, const std::shared_ptr<MetadataInfo> &mdi)
+{
+    std::int64_t block;
+    {
+        std::lock_guard<std::mutex> locker(file.lock);
+        file.sequential  = offset == file.next_offset ? file.sequential + 1 : 0;
+        file.next_offset = offset + size;
+
+        block = file.next_offset / PRIV->blocksize + 1;
+        if (file.sequential < 2 || block == file.readahead_block || block * PRIV->blocksize >= mdi->getMD().size())
+            return;
+        file.readahead_block = block;
+    }
+
+    /* Runs on the worker pool, which is stopped before the caches are destroyed on unmount. */
+    std::string key = std::to_string(file.inode_number) + "_" + std::to_string(block);
+    PRIV->workers.submit([key](){
+        std::shared_ptr<DataInfo> di;
+        if (cached_data(key, di, false))
+            hflat_debug("read-ahead of data block %s failed", key.c_str());
+    });
+}
+
+enum class rw {READ, WRITE};
+static int do_rw(char *buf, size_t size, off_t offset, const std::shared_ptr<MetadataInfo> &mdi, std::shared_ptr<DataInfo> &di, rw mode)
+{
+    int blocknum     = offset / PRIV->blocksize;
+    std::string key  = std::to_string(mdi->getMD().inode_number()) + "_" + std::to_string(blocknum);
     int inblockstart = offset - blocknum * PRIV->blocksize;
     int inblocksize  = size > (size_t) PRIV->blocksize - inblockstart ? PRIV->blocksize - inblockstart : size;
+
+    /* Writers of shared blocks have to hold a lease for the written range. */
+    if(mode == rw::WRITE)
+        if (int err = PRIV->leases.acquire(mdi->getMD().inode_number(), blocknum, inblockstart, inblockstart + inblocksize))
+            return err;
+
+    /* Don't GET if the file is growing. */
+    if (int err = cached_data(key, di, mode == rw::WRITE && offset+size > mdi->getMD().size()))
+        return err;
+
     if(mode == rw::WRITE)  di->updateData(buf, inblockstart, inblocksize);
     if(mode == rw::READ){
         /* After a truncate operation that increases size a client may legally read data that was never written.
@@ -69,11 +110,14 @@ int hflat_read(const char* user_path, char *buf, size_t size, off_t offset, stru
     hflat_debug("reading %d bytes at offset %d for user path %s", size, offset, user_path);
 
     std::shared_ptr<MetadataInfo> mdi;
-    int err = lookup(user_path, mdi);
+    int err = lookup_open_file(user_path, fi, mdi);
     if( err) return err;
 
     std::shared_ptr<DataInfo> di;
-    return do_rw(buf,size,offset,mdi,di,rw::READ);
+    int rtn = do_rw(buf,size,offset,mdi,di,rw::READ);
+    if(rtn > 0 && fi && fi->fh)
+        read_ahead(*reinterpret_cast<OpenFile *>(fi->fh), offset, rtn, mdi);
+    return rtn;
 }
 
 /** Write data to an open file
@@ -89,7 +133,7 @@ int hflat_write(const char* user_path, const char *buf, size_t size, off_t offse
     hflat_debug("writing %d bytes at offset %d for user path %s, O_APPEND: %d", size, offset, user_path, fi->flags & O_APPEND);
 
     std::shared_ptr<MetadataInfo> mdi;
-    int err = lookup(user_path, mdi);
+    int err = lookup_open_file(user_path, fi, mdi);
     if( err) return err;
 
     std::shared_ptr<DataInfo> di;
@@ -105,6 +149,7 @@ int hflat_write(const char* user_path, const char *buf, size_t size, off_t offse
         }
         mdi->setDirtyData(di);
     }
+    PRIV->data_cache.updateCost(di->getKey());
 
     /* check if the write should be immediately flushed or aggregated */
     if( (fi->flags & O_APPEND) || ((offset+size) % PRIV->blocksize == 0) ){
@@ -144,15 +189,8 @@ int hflat_truncate(const char *user_path, off_t offset)
     std::shared_ptr<DataInfo> di;
     if(offset < size){
         std::string key = std::to_string(mdi->getMD().inode_number()) + "_" + std::to_string(offset/PRIV->blocksize);
-        while(PRIV->data_cache.get(key, di) == false){
-              if(PRIV->data_cache.block(key)){
-                  if (int err = get_data(key, di)){
-                      PRIV->data_cache.invalidate(key);
-                      return err;
-                  }
-                  REQ_TRUE(PRIV->data_cache.add(key, di));
-              }
-        }
+        if (int err = cached_data(key, di, false))
+            return err;
         di->truncate(offset % PRIV->blocksize);
         put_data(di);
     }
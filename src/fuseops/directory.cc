@@ -45,14 +45,52 @@ int hflat_rmdir(const char *user_path)
         return -ENOTEMPTY;
 
     util::database_update();
-    return hflat_unlink(user_path);
+    err = hflat_unlink(user_path);
+    if (!err)
+        PRIV->listing_cache.invalidate(std::to_string(mdi->getMD().inode_number()));
+    return err;
 }
 
-int create_directory_entry(const std::shared_ptr<MetadataInfo> &mdi_parent, std::string filename)
+/* Approximate memory used by an entry stored in a directory listing. */
+static std::size_t listing_bytes(const std::string &name)
+{
+    return sizeof(std::string) + name.size() + sizeof(DirectoryListing::Entry) + 4 * sizeof(void *);
+}
+
+/* Apply a local entry change to the cached listing of the parent directory. With POSIX time stamps the parent metadata
+ * key has been updated from version before to the current version: if the listing matches the previous version, it
+ * is moved to the current version. Otherwise it might miss changes of other clients and is left to be refreshed. */
+static void update_listing(const std::shared_ptr<MetadataInfo> &mdi_parent, const std::string &before, bool updated,
+        const std::string &filename, const DirectoryListing::Entry *added)
+{
+    std::shared_ptr<DirectoryListing> listing;
+    if (!PRIV->listing_cache.get(std::to_string(mdi_parent->getMD().inode_number()), listing))
+        return;
+
+    std::lock_guard<std::mutex> locker(listing->lock);
+    if (PRIV->posix == PosixMode::FULL) {
+        if (!updated || listing->keyVersion != before)
+            return;
+        listing->keyVersion = mdi_parent->getKeyVersion();
+    }
+    if (added && listing->entries.insert(std::make_pair(filename, *added)).second)
+        listing->bytes += listing_bytes(filename);
+    if (!added && listing->entries.erase(filename))
+        listing->bytes -= listing_bytes(filename);
+    PRIV->listing_cache.updateCost(std::to_string(mdi_parent->getMD().inode_number()));
+}
+
+/* The entry stores inode number and type of the supplied metadata, so that they can be reported by readdir. */
+int create_directory_entry(const std::shared_ptr<MetadataInfo> &mdi_parent, std::string filename, const std::shared_ptr<MetadataInfo> &mdi)
 {
     string direntry_key = std::to_string(mdi_parent->getMD().inode_number()) + "|" + filename;
 
-    KineticRecord record("", std::to_string(1), "", Command_Algorithm_SHA1);
+    DirectoryListing::Entry entry{mdi->getMD().inode_number(), (mode_t) (mdi->getMD().mode() & S_IFMT)};
+    hflat::DirectoryEntry value;
+    value.set_inode_number(entry.inode_number);
+    value.set_type(entry.type);
+
+    KineticRecord record(value.SerializeAsString(), std::to_string(1), "", Command_Algorithm_SHA1);
     KineticStatus status = PRIV->kinetic->Put(direntry_key, "", WriteMode::REQUIRE_SAME_VERSION, record);
 
     if (status.statusCode() ==  kinetic::StatusCode::REMOTE_VERSION_MISMATCH)
@@ -64,10 +102,16 @@ int create_directory_entry(const std::shared_ptr<MetadataInfo> &mdi_parent, std:
 
     hflat_debug("created key %s for system path %s",direntry_key.c_str(),mdi_parent->getSystemPath().c_str());
 
+    std::string before = mdi_parent->getKeyVersion();
+    int attempts = 0;
     if(PRIV->posix == PosixMode::FULL){
-        int err = put_metadata_forced(mdi_parent, [&mdi_parent](){mdi_parent->updateACMtime();});
-        if (err)  hflat_warning("Failed updating parent directory time stamps after successfully adding directory entry.");
+        int err = put_metadata_forced(mdi_parent, [&mdi_parent, &attempts](){mdi_parent->updateACMtime(); attempts++;});
+        if (err){
+            hflat_warning("Failed updating parent directory time stamps after successfully adding directory entry.");
+            attempts = 0;
+        }
     }
+    update_listing(mdi_parent, before, attempts == 1, filename, &entry);
     return 0;
 }
 
@@ -83,10 +127,171 @@ int delete_directory_entry(const std::shared_ptr<MetadataInfo> &mdi_parent, std:
 
     hflat_debug("deleted key %s for system path %s",direntry_key.c_str(),mdi_parent->getSystemPath().c_str());
 
+    std::string before = mdi_parent->getKeyVersion();
+    int attempts = 0;
     if(PRIV->posix == PosixMode::FULL){
-        int err = put_metadata_forced(mdi_parent, [&mdi_parent](){mdi_parent->updateACMtime();});
-        if (err)  hflat_warning("Failed updating parent directory time stamps after successfully removing directory entry.");
+        int err = put_metadata_forced(mdi_parent, [&mdi_parent, &attempts](){mdi_parent->updateACMtime(); attempts++;});
+        if (err){
+            hflat_warning("Failed updating parent directory time stamps after successfully removing directory entry.");
+            attempts = 0;
+        }
     }
+    update_listing(mdi_parent, before, attempts == 1, filename, nullptr);
+    return 0;
+}
+
+namespace {
+/* Pages grow from the minimum to the maximum size while a directory is read sequentially, so that the first entries
+ * of a directory are returned quickly and large directories are read with few requests. */
+const std::uint32_t min_page_size = 64;
+const std::uint32_t max_page_size = 4096;
+
+/* Number of directory entry values requested concurrently. */
+const std::size_t entry_fetch_window = 16;
+}
+
+/* Replace the page of an open directory with the page following it. */
+static int next_page(OpenDirectory &dir)
+{
+    std::string after = dir.page.empty() ? "" : dir.page.back().first;
+    dir.base += dir.page.size();
+    dir.page.clear();
+
+    if (dir.cached) {
+        std::lock_guard<std::mutex> locker(dir.cached->lock);
+        auto it = after.empty() ? dir.cached->entries.begin() : dir.cached->entries.upper_bound(after);
+        for (; it != dir.cached->entries.end() && dir.page.size() < dir.page_size; it++)
+            dir.page.push_back(*it);
+        dir.complete = it == dir.cached->entries.end();
+    }
+    else {
+        string keystart = std::to_string(dir.inode_number) + "|" + after;
+        string keyend   = std::to_string(dir.inode_number) + "|" + static_cast<char>(251);
+        unique_ptr<vector<std::string>> keys(new vector<string>());
+
+        KineticStatus status = PRIV->kinetic->GetKeyRange(keystart, keyend, dir.page_size, keys);
+        if (!status.ok()) {
+            hflat_warning("Failed listing directory with inode number %lu: %s", dir.inode_number, status.message().c_str());
+            return -EIO;
+        }
+        for (auto& element : *keys)
+            dir.page.push_back(std::make_pair(element.substr(element.find_first_of('|') + 1, element.length()),
+                    DirectoryListing::Entry{0, 0}));
+        dir.complete = keys->size() < dir.page_size;
+
+        /* Entries that can't be read (e.g. written by older clients or removed in the meantime) are reported
+         * without inode number and type. */
+        PRIV->workers.run(keys->size(), entry_fetch_window, [&](std::size_t i){
+            unique_ptr<KineticRecord> record;
+            hflat::DirectoryEntry value;
+            if (PRIV->kinetic->Get((*keys)[i], record).ok() && value.ParseFromString(*record->value()))
+                dir.page[i].second = DirectoryListing::Entry{value.inode_number(), (mode_t) value.type()};
+            return 0;
+        });
+
+        if (dir.listing) {
+            for (auto& entry : dir.page) {
+                dir.listing->bytes += listing_bytes(entry.first);
+                dir.listing->entries.insert(dir.listing->entries.end(), entry);
+            }
+            /* A listing that could not be kept by the listing cache is not built any further. */
+            if (sizeof(DirectoryListing) + dir.listing->bytes > PRIV->listing_cache.maxCost())
+                dir.listing.reset();
+        }
+        if (dir.listing && dir.complete) {
+            std::string key = std::to_string(dir.inode_number);
+            PRIV->listing_cache.invalidate(key);
+            if (!PRIV->listing_cache.add(key, dir.listing))
+                hflat_debug("listing of directory with inode number %s has been cached concurrently", key.c_str());
+            dir.listing.reset();
+        }
+    }
+    dir.page_size = std::min(dir.page_size * 2, max_page_size);
+    return 0;
+}
+
+/* Start reading an open directory from the first entry. A cached listing is used if it is still valid, otherwise
+ * the directory entries are read from the flat namespace. */
+static void rewind_directory(const std::shared_ptr<MetadataInfo> &mdi, OpenDirectory &dir)
+{
+    dir.inode_number = mdi->getMD().inode_number();
+    dir.base = 0;
+    dir.page.clear();
+    dir.page_size = min_page_size;
+    dir.complete = false;
+    dir.cached.reset();
+    dir.listing.reset();
+
+    std::shared_ptr<DirectoryListing> listing;
+    if (PRIV->listing_cache.get(std::to_string(dir.inode_number), listing)) {
+        std::lock_guard<std::mutex> locker(listing->lock);
+        if (PRIV->posix != PosixMode::FULL || listing->keyVersion == mdi->getKeyVersion())
+            dir.cached = listing;
+    }
+
+    /* Entries are read after the directory metadata, so the listing contains at least all entries of that version. */
+    if (!dir.cached) {
+        dir.listing.reset(new DirectoryListing());
+        dir.listing->keyVersion = mdi->getKeyVersion();
+    }
+}
+
+static std::string entry_path(const char *user_path, const std::string &name)
+{
+    std::string path(user_path);
+    if (path.back() != '/')
+        path += '/';
+    return path + name;
+}
+
+/* Look up the metadata of all entries of the current page concurrently, so that it is cached when the attributes of
+ * the entries are requested. */
+static void prefetch_attributes(const char *user_path, const OpenDirectory &dir)
+{
+    PRIV->workers.run(dir.page.size(), entry_fetch_window, [&](std::size_t i){
+        std::shared_ptr<MetadataInfo> mdi;
+        lookup(entry_path(user_path, dir.page[i].first).c_str(), mdi);
+        return 0;
+    });
+}
+
+/* Fill in the attributes of an entry if enabled, or only the inode number and type stored in the entry. Path
+ * permissions are checked for the calling user, attributes of inaccessible entries are not reported. */
+static void entry_attributes(const char *user_path, const std::pair<std::string, DirectoryListing::Entry> &entry, struct stat *attr)
+{
+    memset(attr, 0, sizeof(struct stat));
+    attr->st_ino = entry.second.inode_number;
+    attr->st_mode = entry.second.type;
+
+    std::shared_ptr<MetadataInfo> mdi;
+    if (!PRIV->options.readdir_attributes || lookup(entry_path(user_path, entry.first).c_str(), mdi))
+        return;
+    /* Attributes of inodes with outstanding writes are only up to date after flushing, compare hflat_getattr. */
+    if (mdi->getDirtyData() && mdi->getDirtyData()->hasUpdates())
+        return;
+    metadata_to_stat(mdi, attr);
+}
+
+/** Open directory
+ *
+ * Introduced in version 2.3
+ */
+int hflat_opendir(const char *user_path, struct fuse_file_info *fi)
+{
+    if (int err = hflat_open(user_path, fi))
+        return err;
+    fi->fh = reinterpret_cast<std::uint64_t>(new OpenDirectory());
+    return 0;
+}
+
+/** Release directory
+ *
+ * Introduced in version 2.3
+ */
+int hflat_releasedir(const char *user_path, struct fuse_file_info *fi)
+{
+    delete reinterpret_cast<OpenDirectory *>(fi->fh);
+    fi->fh = 0;
     return 0;
 }
 
@@ -120,21 +325,28 @@ int hflat_readdir(const char *user_path, void *buffer, fuse_fill_dir_t filldir,
     if (check_access(mdi, R_OK)) // ls requires read permission
         return -EACCES;
 
-    string keystart = std::to_string(mdi->getMD().inode_number()) + "|";
-    string keyend   = std::to_string(mdi->getMD().inode_number()) + "|" + static_cast<char>(251);
-    size_t maxsize = 100;
-    unique_ptr<vector<std::string>> keys(new vector<string>());
-
-    do {
-        if (keys->size())
-            keystart = keys->back();
-        keys->clear();
-        PRIV->kinetic->GetKeyRange(keystart, keyend, maxsize, keys);
-        for (auto& element : *keys) {
-            std::string filename = element.substr(element.find_first_of('|') + 1, element.length());
-            filldir(buffer, filename.c_str(), NULL, 0);
-        }
-    } while (keys->size() == maxsize);
+    /* Without a handle the directory is read from the start for each call. */
+    OpenDirectory local;
+    OpenDirectory &dir = fi && fi->fh ? *reinterpret_cast<OpenDirectory *>(fi->fh) : local;
+    std::lock_guard<std::mutex> locker(dir.lock);
 
-    return 0;
+    /* The offset of an entry is its position + 1. Reading continues at the supplied offset, which usually is within
+     * the current page. Otherwise the directory is read again from the start. */
+    if (offset == 0 || offset < dir.base || offset > dir.base + (std::int64_t) dir.page.size())
+        rewind_directory(mdi, dir);
+
+    for (std::int64_t position = offset; ; position++) {
+        while (position >= dir.base + (std::int64_t) dir.page.size()) {
+            if (dir.complete)
+                return 0;
+            if ((err = next_page(dir)))
+                return err;
+            if (PRIV->options.readdir_attributes)
+                prefetch_attributes(user_path, dir);
+        }
+        struct stat attr;
+        entry_attributes(user_path, dir.page[position - dir.base], &attr);
+        if (filldir(buffer, dir.page[position - dir.base].first.c_str(), &attr, position + 1))
+            return 0;
+    }
 }
@@ -46,8 +46,8 @@ int unlink_lookup(const char *user_path, std::shared_ptr<MetadataInfo> &mdi, std
     if (check_access(mdi_dir, W_OK | X_OK))
         return -EACCES;
     // If sticky bit is set on directory, current user needs to be owner of directory OR file (or root of course).
-    if (fuse_get_context()->uid && (mdi_dir->getMD().mode() & S_ISVTX) && (fuse_get_context()->uid != mdi_dir->getMD().uid())
-            && (fuse_get_context()->uid != mdi->getMD().uid()))
+    if (hflat_get_context()->uid && (mdi_dir->getMD().mode() & S_ISVTX) && (hflat_get_context()->uid != mdi_dir->getMD().uid())
+            && (hflat_get_context()->uid != mdi->getMD().uid()))
         return -EACCES;
     return 0;
 };
@@ -86,6 +86,22 @@ static int unlink_hardlink(const char *user_path, const std::shared_ptr<Metadata
     return 0;
 }
 
+/* start a background thread to delete data blocks of an inode */
+static void delete_data_blocks(const std::shared_ptr<MetadataInfo> &mdi)
+{
+    auto datadelete = [](int size, int ino, struct hflat_priv *priv){
+        while(size > 0){
+            std::string key = std::to_string(ino) + "_" + std::to_string(size / priv->blocksize);
+            priv->kinetic->Delete(key, "", WriteMode::IGNORE_VERSION);
+            if(priv->leases.enabled())
+                priv->kinetic->Delete(WriteLeases::leaseKey(ino, size / priv->blocksize), "", WriteMode::IGNORE_VERSION);
+            size -= priv->blocksize;
+        }
+    };
+    std::thread t(std::bind(datadelete,mdi->getMD().size(), mdi->getMD().inode_number(), PRIV));
+    t.detach();
+}
+
 /** Remove a file */
 int hflat_unlink(const char *user_path)
 {
@@ -116,18 +132,10 @@ int hflat_unlink(const char *user_path)
     /* remove directory entry */
     REQ_0( delete_directory_entry(mdi_dir, path_to_filename(user_path)) );
 
-    /* start a background thread to delete now unused data blocks */
-    auto datadelete = [](int size, int ino, struct hflat_priv *priv){
-        while(size > 0){
-            std::string key = std::to_string(ino) + "_" + std::to_string(size / priv->blocksize);
-            priv->kinetic->Delete(key, "", WriteMode::IGNORE_VERSION);
-            size -= priv->blocksize;
-        }
-    };
-    if(!hardlink || mdi->getMD().link_count() == 0){
-        std::thread t(std::bind(datadelete,mdi->getMD().size(), mdi->getMD().inode_number(), PRIV));
-        t.detach();
-    }
+    /* Delete now unused data blocks, unless the file is still open. In that case the data is deleted on release. */
+    if(!hardlink || mdi->getMD().link_count() == 0)
+        if(!PRIV->open_files.unlinked(mdi->getMD().inode_number()))
+            delete_data_blocks(mdi);
 
 
     /* Look for a potential unused reuse mapping.
@@ -181,6 +189,23 @@ int hflat_open(const char *user_path, struct fuse_file_info *fi)
         err = check_access(mdi, R_OK | W_OK);
     if (err)
         return err;
+
+    /* Keep the kernel page cache if the file has not changed since it was last released. In RELAXED mode
+     * data can change without touching the metadata key, so the page cache is always invalidated. */
+    if (S_ISREG(mdi->getMD().mode()) && PRIV->posix == PosixMode::FULL) {
+        std::string key = std::to_string(mdi->getMD().inode_number());
+        std::shared_ptr<PageCacheInfo> pci;
+        if (PRIV->pagecache_info.get(key, pci)) {
+            if (pci->keyVersion == mdi->getKeyVersion() && pci->mtime == mdi->getMD().mtime())
+                fi->keep_cache = 1;
+            else
+                PRIV->pagecache_info.invalidate(key);
+        }
+    }
+
+    /* Data operations using the file handle skip path resolution. */
+    if (S_ISREG(mdi->getMD().mode()))
+        fi->fh = reinterpret_cast<std::uint64_t>(PRIV->open_files.open(mdi));
     return 0;
 }
 
@@ -200,29 +225,54 @@ int hflat_open(const char *user_path, struct fuse_file_info *fi)
  */
 int hflat_release(const char *user_path, struct fuse_file_info *fi)
 {
-    return hflat_fsync(user_path, 0, fi);
+    /* The handle is released even if flushing fails, the flush error is reported afterwards. */
+    int flush_err = hflat_fsync(user_path, 0, fi);
+
+    std::shared_ptr<MetadataInfo> mdi;
+    if (fi && fi->fh) {
+        int err = lookup_open_file(user_path, fi, mdi);
+        bool unlinked = false;
+        bool last = PRIV->open_files.release(reinterpret_cast<OpenFile *>(fi->fh), mdi, unlinked);
+        fi->fh = 0;
+        if (!mdi || !last)
+            return flush_err;
+        if (unlinked) {
+            delete_data_blocks(mdi);
+            PRIV->leases.release(mdi->getMD().inode_number());
+            return flush_err;
+        }
+        if (err)
+            return flush_err;
+    }
+    else if (!user_path || lookup(user_path, mdi) || !S_ISREG(mdi->getMD().mode()))
+        return flush_err;
+
+    /* Data that failed to flush is still cached, leases and page cache state are kept. */
+    if (flush_err)
+        return flush_err;
+
+    /* All data has been flushed, write leases are no longer required. */
+    PRIV->leases.release(mdi->getMD().inode_number());
+
+    /* Remember the metadata state the kernel page cache corresponds to, compare hflat_open. */
+    std::shared_ptr<PageCacheInfo> pci(new PageCacheInfo{ std::to_string(mdi->getMD().inode_number()), mdi->getKeyVersion(), mdi->getMD().mtime() });
+    PRIV->pagecache_info.invalidate(pci->key);
+    if (!PRIV->pagecache_info.add(pci->key, pci))
+        hflat_debug("Concurrent release for inode %s, not storing page cache information.", pci->key.c_str());
+    return 0;
 }
 
 void inherit_path_permissions(const std::shared_ptr<MetadataInfo> &mdi, const std::shared_ptr<MetadataInfo> &mdi_parent)
 {
-    /* Inherit path permissions existing for directory */
-     mdi->getMD().mutable_path_permission()->CopyFrom(mdi_parent->getMD().path_permission());
-     mdi->getMD().set_path_permission_verified(mdi_parent->getMD().path_permission_verified());
-
-     /* Add path permissions precomputed for directory's children. */
-     for (int i = 0; i < mdi_parent->getMD().path_permission_children_size(); i++) {
-         hflat::Metadata::ReachabilityEntry *e = mdi->getMD().add_path_permission();
-         e->CopyFrom(mdi_parent->getMD().path_permission_children(i));
-     }
-     if (S_ISDIR(mdi->getMD().mode())) mdi->computePathPermissionChildren();
+    mdi->inheritPathPermissions(*mdi_parent);
 }
 
 void initialize_metadata(const std::shared_ptr<MetadataInfo> &mdi, const std::shared_ptr<MetadataInfo> &mdi_parent, mode_t mode)
 {
     mdi->updateACMtime();
     mdi->getMD().set_type(hflat::Metadata_InodeType_POSIX);
-    mdi->getMD().set_gid(fuse_get_context()->gid);
-    mdi->getMD().set_uid(fuse_get_context()->uid);
+    mdi->getMD().set_gid(hflat_get_context()->gid);
+    mdi->getMD().set_uid(hflat_get_context()->uid);
     mdi->getMD().set_mode(mode);
     mdi->getMD().set_inode_number(generate_inode_number());
     inherit_path_permissions(mdi,mdi_parent);
@@ -246,12 +296,14 @@ int hflat_create(const char *user_path, mode_t mode)
     err = check_access(mdi_dir, W_OK);
     if(err) return err;
 
+    /* initialize metadata, the directory entry refers to its inode number */
+    initialize_metadata(mdi, mdi_dir, mode);
+
     /* Add filename to directory */
-    err = create_directory_entry(mdi_dir, path_to_filename(user_path));
+    err = create_directory_entry(mdi_dir, path_to_filename(user_path), mdi);
     if (err) return err;
 
-    /* initialize metadata and write metadata-key to drive*/
-    initialize_metadata(mdi, mdi_dir, mode);
+    /* write metadata-key to drive*/
     REQ_0( create_metadata(mdi) );
     return 0;
 }
@@ -270,7 +322,16 @@ int hflat_create(const char *user_path, mode_t mode)
  */
 int hflat_fcreate(const char *user_path, mode_t mode, struct fuse_file_info *fi)
 {
-    return hflat_create(user_path, mode);
+    int err = hflat_create(user_path, mode);
+    if (err || !S_ISREG(mode))
+        return err;
+
+    /* The creating process may write to the file regardless of the supplied mode, compare hflat_open. */
+    std::shared_ptr<MetadataInfo> mdi;
+    if ((err = lookup(user_path, mdi)))
+        return err;
+    fi->fh = reinterpret_cast<std::uint64_t>(PRIV->open_files.open(mdi));
+    return 0;
 }
 
 
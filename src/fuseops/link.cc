@@ -31,7 +31,7 @@ int hflat_readlink(const char *user_path, char *buffer, size_t size)
 {
     std::string link_destination;
     std::int64_t pathPermissionTimeStamp = 0;
-    link_destination = PRIV->pmap.toSystemPath(user_path, pathPermissionTimeStamp, CallingType::READLINK);
+    PRIV->pmap.toSystemPath(user_path, link_destination, pathPermissionTimeStamp, CallingType::READLINK);
 
     if (link_destination.length() >= size) {
         hflat_debug("buffer too small to fit link destination.");
@@ -55,9 +55,13 @@ int hflat_symlink(const char *target, const char *origin)
 
     err = lookup_parent(origin, mdi_dir);
     if(!err) err = check_access(mdi_dir, W_OK);
-    if(!err) err = create_directory_entry(mdi_dir, util::path_to_filename(origin));
     if (err) return err;
 
+    /* initialize metadata, the directory entry refers to its inode number */
+    initialize_metadata(mdi, mdi_dir, S_IFLNK | S_IRWXU | S_IRGRP | S_IXGRP | S_IXOTH);
+    if ((err = create_directory_entry(mdi_dir, util::path_to_filename(origin), mdi)))
+        return err;
+
     hflat::db_entry entry;
     entry.set_type(entry.SYMLINK);
     entry.set_origin(origin);
@@ -70,8 +74,7 @@ int hflat_symlink(const char *target, const char *origin)
         return err;
     }
 
-    /* initialize metadata and write metadata-key to drive */
-    initialize_metadata(mdi, mdi_dir, S_IFLNK | S_IRWXU | S_IRGRP | S_IXGRP | S_IXOTH);
+    /* write metadata-key to drive */
     REQ_0( create_metadata(mdi) );
     return err;
 }
@@ -126,7 +129,7 @@ int hflat_hardlink(const char *target, const char *origin)
 
 
     /* many clients try to create hardlink -> serialization over direntry */
-    if ((err = create_directory_entry(mdi_origin_dir, util::path_to_filename(origin))))
+    if ((err = create_directory_entry(mdi_origin_dir, util::path_to_filename(origin), mdi_target)))
         return err;
 
     /* If the target metadata is not already a hardlink_target, make it so. */
@@ -22,7 +22,7 @@
 int check_access(const std::shared_ptr<MetadataInfo> &mdi, int mode)
 {
     /* root does as (s)he pleases */
-    if (fuse_get_context()->uid == 0)
+    if (hflat_get_context()->uid == 0)
         return 0;
     /* only test for existence of file */
     if (mode == F_OK)
@@ -31,14 +31,14 @@ int check_access(const std::shared_ptr<MetadataInfo> &mdi, int mode)
     /* check file permissions */
     unsigned int umode = mode;
     /* test user */
-    if (mdi->getMD().uid() == fuse_get_context()->uid) {
+    if (mdi->getMD().uid() == hflat_get_context()->uid) {
         if ((mode & mdi->getMD().mode() >> 6) == umode)
             return 0;
         else
             return -EACCES;
     }
     /* test group */
-    if (mdi->getMD().gid() == fuse_get_context()->gid) {
+    if (mdi->getMD().gid() == hflat_get_context()->gid) {
         if ((mode & mdi->getMD().mode() >> 3) == umode)
             return 0;
         else
@@ -68,7 +68,7 @@ int hflat_access(const char *user_path, int mode)
     if (strlen(user_path) == 1)
         return 0;
 
-    if (fuse_get_context()->uid == 0)
+    if (hflat_get_context()->uid == 0)
         return 0;
 
     std::shared_ptr<MetadataInfo> mdi;
@@ -84,17 +84,17 @@ static int permission_lookup(const char *user_path, std::shared_ptr<MetadataInfo
         return err;
 
     /* Root can do what (s)he wants. */
-    if(fuse_get_context()->uid == 0)
+    if(hflat_get_context()->uid == 0)
         return 0;
 
     /* Non-owner isn't actually allowed to change anything. */
-    if(fuse_get_context()->uid != mdi->getMD().uid())
+    if(hflat_get_context()->uid != mdi->getMD().uid())
         return -EPERM;
 
     /* Owner can change group only to a group of which he is a member.
      * TODO: group member-check -> Not possible in fuse with system groups.
      * We alternatively enforce that the owner can only change the group to his currently active group. */
-    if ((gid != (gid_t) -1) && (gid != fuse_get_context()->gid))
+    if ((gid != (gid_t) -1) && (gid != hflat_get_context()->gid))
         return -EPERM;
 
     return 0;
@@ -107,12 +107,12 @@ static int do_permission_change(const char *user_path, mode_t mode, uid_t uid, g
     if( err) return err;
 
     /* when non-super-user calls chmod successfully, if the group ID of the file is not the effective group ID and if the file is a regular file, set-gid is cleared */
-    if(fuse_get_context()->uid && (mode != (mode_t)-1) && fuse_get_context()->gid != mdi->getMD().gid() && S_ISREG(mode)){
+    if(hflat_get_context()->uid && (mode != (mode_t)-1) && hflat_get_context()->gid != mdi->getMD().gid() && S_ISREG(mode)){
        mode &= ~S_ISGID;
     }
 
     /* when non-super-user calls chown successfully, set-uid and set-gid bits are removed, except when both uid and gid are equal to -1.*/
-    if(fuse_get_context()->uid && (uid != (uid_t) -1 || gid != (gid_t) -1)){
+    if(hflat_get_context()->uid && (uid != (uid_t) -1 || gid != (gid_t) -1)){
         assert(mode == (mode_t)-1);
         mode = mdi->getMD().mode();
         mode &= ~S_ISUID;
@@ -140,6 +140,7 @@ static int do_permission_change(const char *user_path, mode_t mode, uid_t uid, g
         std::int64_t snapshot_version = PRIV->pmap.getSnapshotVersion();
         err = put_metadata_forced(mdi, [&mdi, &snapshot_version](){ mdi->getMD().set_path_permission_verified(snapshot_version);});
         assert(!err || err == -ENOENT);
+        PRIV->permission_verifier.schedule(user_path);
     }
     return 0;
 }
@@ -20,7 +20,6 @@
 #include "kinetic_helper.h"
 #include <sys/param.h>
 
-using com::seagate::kinetic::client::proto::Command_Algorithm_SHA1;
 
 static int rename_lookup(
         const char *user_path_from, const char *user_path_to,
@@ -43,8 +42,8 @@ static int rename_lookup(
     if  (err) return err;
 
     /* If sticky bit is set on parent directory, current user needs to be owner of parent directory OR the moved entity (or root of course). */
-    if (fuse_get_context()->uid && (dir_mdifrom->getMD().mode() & S_ISVTX) && (fuse_get_context()->uid != dir_mdifrom->getMD().uid())
-          && (fuse_get_context()->uid != mdifrom->getMD().uid()))
+    if (hflat_get_context()->uid && (dir_mdifrom->getMD().mode() & S_ISVTX) && (hflat_get_context()->uid != dir_mdifrom->getMD().uid())
+          && (hflat_get_context()->uid != mdifrom->getMD().uid()))
       return -EACCES;
 
     err = lookup(user_path_to, mdito);
@@ -54,8 +53,8 @@ static int rename_lookup(
     /* Path does exist. Make sure we're allowed to proceed. */
     /* rename returns EACCES or EPERM if the file pointed at by the 'to' argument exists, the directory containing 'to' is marked sticky,
      * and neither the containing directory nor 'to' are owned by the effective user ID */
-    if (fuse_get_context()->uid && (dir_mdito->getMD().mode() & S_ISVTX) && (fuse_get_context()->uid != dir_mdito->getMD().uid())
-           && (fuse_get_context()->uid != mdito->getMD().uid()))
+    if (hflat_get_context()->uid && (dir_mdito->getMD().mode() & S_ISVTX) && (hflat_get_context()->uid != dir_mdito->getMD().uid())
+           && (hflat_get_context()->uid != mdito->getMD().uid()))
        return -EACCES;
 
     /* write permissions to both directories required */
@@ -73,13 +72,16 @@ static int rename_regular(
     mdifrom->updateACtime();
 
     /* store md-key referenced by mdfrom in location pointed to be mdito */
-    KineticRecord record(mdifrom->getMD().SerializeAsString(), mdito->getKeyVersion(), "", Command_Algorithm_SHA1);
+    KineticRecord record = util::serialized_record(mdifrom->getMD(), mdito->getKeyVersion());
     KineticStatus status = PRIV->kinetic->Put(mdito->getSystemPath(), "", WriteMode::REQUIRE_SAME_VERSION, record);
     if(!status.ok()) return -EIO;
 
     /* delete mdifrom */
     status = PRIV->kinetic->Delete(mdifrom->getSystemPath(), "", WriteMode::IGNORE_VERSION);
     if(!status.ok()) return -EIO;
+
+    /* open file handles refer to the metadata key */
+    PRIV->open_files.renamed(mdifrom->getMD().inode_number(), mdifrom->getSystemPath(), mdito->getSystemPath());
     return 0;
 }
 
@@ -160,6 +162,11 @@ int hflat_rename(const char *user_path_from, const char *user_path_to)
     int err = rename_lookup(user_path_from, user_path_to, dir_mdifrom, dir_mdito, mdifrom, mdito);
     if (err) return err;
 
+    /* Flush aggregated writes, they are associated with the metadata of the original location. */
+    if (mdifrom->getDirtyData() && mdifrom->getDirtyData()->hasUpdates())
+        if ((err = hflat_fsync(user_path_from, 0, nullptr)))
+            return err;
+
     /* Remove potentially existing target if possible */
     if(mdito->getMD().inode_number()){
         if (S_ISDIR(mdito->getMD().mode()))
@@ -174,13 +181,13 @@ int hflat_rename(const char *user_path_from, const char *user_path_to)
     }
 
     /* Create new directory entry: Synchronization point (1) */
-    if ((err = create_directory_entry(dir_mdito, util::path_to_filename(user_path_to)) ))
+    if ((err = create_directory_entry(dir_mdito, util::path_to_filename(user_path_to), mdifrom) ))
         return err;
 
     /* create recovery key in order to guarantee that fsck works correctly in all cases if client
      * crashes somewhere between this point and successfully finishing the rename operation. */
     std::string recovery_direntry = util::path_to_filename(user_path_to) + "|recovery|" + user_path_from;
-    REQ_0( create_directory_entry (dir_mdito, recovery_direntry) );
+    REQ_0( create_directory_entry (dir_mdito, recovery_direntry, mdifrom) );
 
     /* Delete old directory entry: Synchronization point (2) */
     if (( err = delete_directory_entry(dir_mdifrom, util::path_to_filename(user_path_from)) )){
@@ -18,6 +18,24 @@
 #include "kinetic_helper.h"
 #include "debug.h"
 
+/* Grow size to at least the supplied size and advance time stamps to the current time. Never
+ * moves a value backwards, so applying it to concurrently updated metadata does not lose updates. */
+static void merge_size_and_times(const std::shared_ptr<MetadataInfo> &mdi, std::uint64_t size)
+{
+    hflat::Metadata &md = mdi->getMD();
+    std::uint32_t atime = md.atime();
+    std::uint32_t mtime = md.mtime();
+    std::uint32_t ctime = md.ctime();
+
+    size = std::max(size, (std::uint64_t) md.size());
+    md.set_size(size);
+    md.set_blocks((size / PRIV->blocksize) + 1);
+    mdi->updateACMtime();
+    md.set_atime(std::max(atime, md.atime()));
+    md.set_mtime(std::max(mtime, md.mtime()));
+    md.set_ctime(std::max(ctime, md.ctime()));
+}
+
 /** Synchronize file contents
  *
  * If the datasync parameter is non-zero, then only the user data
@@ -28,28 +46,52 @@
 int hflat_fsync(const char *user_path, int datasync, struct fuse_file_info *fi)
 {
     std::shared_ptr<MetadataInfo> mdi;
-    int err = lookup(user_path, mdi);
+    int err = lookup_open_file(user_path, fi, mdi);
     if( err) return err;
 
+    OpenFile *file = fi ? reinterpret_cast<OpenFile *>(fi->fh) : nullptr;
+
     std::shared_ptr<DataInfo> di = mdi->getDirtyData();
     if(! di || ! di->hasUpdates() )
         return 0;
 
     /* Data and metadata is flushed as a unit, synchronized over the metadata key. Different flush rules for O_APPEND and regular */
     int blocknum = util::to_int64(di->getKey().substr(di->getKey().find_first_of('_',0)+1,di->getKey().size()));
-    size_t newsize = std::max((std::uint64_t) PRIV->blocksize * blocknum + di->data().size(), (std::uint64_t) mdi->getMD().size());
+    std::uint64_t blockend = (std::uint64_t) PRIV->blocksize * blocknum + di->data().size();
+    size_t newsize = std::max(blockend, (std::uint64_t) mdi->getMD().size());
+
+    /* The metadata key of an unlinked file no longer exists, its data remains accessible until the file is released. */
+    std::string key;
+    std::shared_ptr<MetadataInfo> last_known;
+    if(file && !PRIV->open_files.get(*file, key, last_known)){
+        merge_size_and_times(mdi, blockend);
+        return put_data(di);
+    }
+
     if(mdi->getMD().size() < newsize || PRIV->posix == PosixMode::FULL){
-       mdi->getMD().set_size(newsize);
-       mdi->getMD().set_blocks((newsize / PRIV->blocksize) + 1);
-       mdi->updateACMtime();
-       err = put_metadata(mdi);
-       /* O_APPEND -> can't allow non-serialized data changes*/
-       if(err && fi && (fi->flags & O_APPEND)){
-           PRIV->data_cache.invalidate(di->getKey());
-           return err;
-       }
-       if(err == -EAGAIN) return hflat_fsync(user_path, datasync, fi);
-       if(err) hflat_error("Impossible Error. ");
+        /* O_APPEND -> can't allow non-serialized data changes*/
+        if(fi && (fi->flags & O_APPEND)){
+            mdi->getMD().set_size(newsize);
+            mdi->getMD().set_blocks((newsize / PRIV->blocksize) + 1);
+            mdi->updateACMtime();
+            err = put_metadata(mdi);
+            if(err){
+                PRIV->data_cache.invalidate(di->getKey());
+                return err;
+            }
+        }
+        /* Size and time stamps only ever grow, so a concurrent update of the metadata key can be merged instead of
+         * retrying the flush. Concurrent local flushes of the same file are combined into a single put. Only the
+         * end of the flushed block is merged: the cached size might be stale, e.g. if another client truncated. */
+        else{
+            err = mdi->batchFlush(blockend, [&mdi](std::uint64_t size){
+                return put_metadata_forced(mdi, [&mdi, size](){ merge_size_and_times(mdi, size); });
+            });
+            if(err){
+                hflat_warning("Failed updating metadata for user path %s, data remains dirty.", user_path);
+                return err;
+            }
+        }
     }
    /* write data key */
    return put_data(di);
@@ -0,0 +1,164 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "main.h"
+#include "debug.h"
+
+namespace {
+const std::uint64_t min_range_size = 1 << 10;
+const std::uint64_t max_range_size = 1 << 24;
+
+/* Ranges used up within fast are followed by a range twice the size, ranges lasting longer than slow by one
+ * half the size. */
+const std::chrono::seconds fast(10);
+const std::chrono::seconds slow(600);
+}
+
+InodeAllocator::InodeAllocator() :
+        current(nullptr), ranges(), next(), size(1 << 16), result(0), claim(), requested(false),
+        shutdown(false), prefetcher(), lock(), changed()
+{
+}
+
+InodeAllocator::~InodeAllocator()
+{
+    stop();
+}
+
+int InodeAllocator::claimRange(std::unique_ptr<Range> &range, std::uint64_t count)
+{
+    std::uint64_t base;
+    if (int err = claim(count, base))
+        return err;
+
+    range.reset(new Range());
+    /* 0 is not a valid inode number */
+    range->next = base ? base : 1;
+    range->end = base + count;
+    range->prefetch = range->end - count / 4;
+    return 0;
+}
+
+int InodeAllocator::start(struct hflat_priv *priv, const Claim &fn)
+{
+    claim = fn;
+    std::unique_ptr<Range> first;
+    if (int err = claimRange(first, size))
+        return err;
+    first->started = std::chrono::steady_clock::now();
+    ranges.push_back(std::move(first));
+    current = ranges.back().get();
+
+    prefetcher = std::thread([this, priv](){
+        struct fuse_context context;
+        memset(&context, 0, sizeof(context));
+        context.private_data = priv;
+        hflat_set_context(&context);
+
+        std::unique_lock<std::mutex> locker(lock);
+        while (!shutdown) {
+            changed.wait(locker, [this](){ return requested || shutdown; });
+            if (shutdown)
+                break;
+            std::uint64_t count = size;
+            locker.unlock();
+            std::unique_ptr<Range> range;
+            int err = claimRange(range, count);
+            if (err)
+                hflat_warning("Failed claiming %lu inode numbers: %d", count, err);
+            locker.lock();
+            next = std::move(range);
+            result = err;
+            requested = false;
+            changed.notify_all();
+        }
+        hflat_set_context(nullptr);
+    });
+    return 0;
+}
+
+void InodeAllocator::stop()
+{
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        shutdown = true;
+        changed.notify_all();
+    }
+    if (prefetcher.joinable())
+        prefetcher.join();
+}
+
+void InodeAllocator::requestPrefetch()
+{
+    std::lock_guard<std::mutex> locker(lock);
+    if (!next && !requested) {
+        requested = true;
+        changed.notify_all();
+    }
+}
+
+/* Replace the exhausted range with the prefetched one, waiting for the prefetch if it didn't keep up. */
+int InodeAllocator::advance(Range *exhausted)
+{
+    std::unique_lock<std::mutex> locker(lock);
+    while (current.load() == exhausted) {
+        if (next) {
+            auto now = std::chrono::steady_clock::now();
+            if (now - exhausted->started < fast)
+                size = std::min(size * 2, max_range_size);
+            else if (now - exhausted->started > slow)
+                size = std::max(size / 2, min_range_size);
+
+            next->started = now;
+            ranges.push_back(std::move(next));
+            current = ranges.back().get();
+            break;
+        }
+        if (shutdown)
+            return -EIO;
+
+        /* A failed prefetch that was already running when we got here is retried once. */
+        bool running = requested;
+        requested = true;
+        changed.notify_all();
+        changed.wait(locker, [this](){ return !requested || shutdown; });
+        if (!next && !running && result)
+            return result;
+    }
+    return 0;
+}
+
+int InodeAllocator::allocate(std::uint64_t &number)
+{
+    for (;;) {
+        Range *r = current.load();
+        std::uint64_t n = r->next++;
+        if (n < r->end) {
+            if (n == r->prefetch)
+                requestPrefetch();
+            number = n;
+            return 0;
+        }
+        if (int err = advance(r))
+            return err;
+    }
+}
+
+std::uint64_t InodeAllocator::position() const
+{
+    Range *r = current.load();
+    return r ? std::min<std::uint64_t>(r->next, r->end) : 0;
+}
@@ -0,0 +1,89 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef INODE_ALLOCATOR_H_
+#define INODE_ALLOCATOR_H_
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+struct hflat_priv;
+
+/* Hands out inode numbers from ranges claimed in the shared namespace.
+ *
+ * Numbers are taken from the current range with a single atomic increment. Once a quarter of the current range is
+ * left, the next range is claimed by a background thread, so that it is usually available before the current range
+ * runs out. The range size adapts to the create rate: ranges that are used up quickly are followed by larger ones,
+ * ranges that last long by smaller ones, limiting the number of claims as well as the numbers lost on unmount. */
+class InodeAllocator final
+{
+public:
+    /* Claim count consecutive numbers, storing the first one in base. Returns 0 or a negative error code. */
+    typedef std::function<int(std::uint64_t count, std::uint64_t &base)> Claim;
+
+private:
+    struct Range
+    {
+        std::atomic<std::uint64_t>  next;
+        std::uint64_t               end;
+        std::uint64_t               prefetch;   // number that triggers claiming the next range
+        std::chrono::steady_clock::time_point started;  // when the range became current
+    };
+
+    /* Ranges are never freed while the allocator exists: threads might still increment an exhausted range. */
+    std::atomic<Range *>                current;
+    std::vector<std::unique_ptr<Range>> ranges;
+    std::unique_ptr<Range>              next;       // claimed in the background, not yet in use
+    std::uint64_t                       size;       // of the next range claimed
+    int                                 result;     // of the last background claim
+
+    Claim                   claim;
+    bool                    requested;
+    bool                    shutdown;
+    std::thread             prefetcher;
+    std::mutex              lock;
+    std::condition_variable changed;
+
+private:
+    int claimRange(std::unique_ptr<Range> &range, std::uint64_t count);
+    void requestPrefetch();
+    int advance(Range *exhausted);
+
+public:
+    /* Claim the first range and start prefetching in the background. Returns 0 or a negative error code. */
+    int start(struct hflat_priv *priv, const Claim &fn);
+    void stop();
+
+    /* Returns 0 and stores a new inode number or returns a negative error code if no range could be claimed. */
+    int allocate(std::uint64_t &number);
+
+    /* The next number of the current range, an upper bound of the numbers handed out by this client. */
+    std::uint64_t position() const;
+
+public:
+    explicit InodeAllocator();
+    ~InodeAllocator();
+    InodeAllocator(const InodeAllocator& rhs) = delete;
+    InodeAllocator& operator=(const InodeAllocator& rhs) = delete;
+};
+
+#endif /* INODE_ALLOCATOR_H_ */
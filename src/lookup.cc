@@ -27,7 +27,7 @@ int get_metadata_userpath(const char *user_path, std::shared_ptr<MetadataInfo> &
     std::int64_t pathPermissionTimeStamp = 0;
 
     /* Step 1: Transform user path to system path and obtain required path permission timestamp */
-    key = PRIV->pmap.toSystemPath(user_path, pathPermissionTimeStamp, CallingType::LOOKUP);
+    PRIV->pmap.toSystemPath(user_path, key, pathPermissionTimeStamp, CallingType::LOOKUP);
     if (pathPermissionTimeStamp < 0)
         return pathPermissionTimeStamp;
 
@@ -37,64 +37,19 @@ int get_metadata_userpath(const char *user_path, std::shared_ptr<MetadataInfo> &
 }
 
 
-/* For full functionality, all group checks should do in_group checks instead of straight
- * comparisons, compare chown. */
-static int check_path_permissions(const google::protobuf::RepeatedPtrField<hflat::Metadata_ReachabilityEntry > &path_permissions){
-
-
-    for(int i=0; i < path_permissions.size(); i++){
-        const hflat::Metadata_ReachabilityEntry &e = path_permissions.Get(i);
-
-        switch(e.type()){
-
-        case hflat::Metadata_ReachabilityType_UID:
-            if(fuse_get_context()->uid != e.uid())
-                return -EACCES;
-            break;
-        case hflat::Metadata_ReachabilityType_GID:
-            if(fuse_get_context()->gid != e.gid())
-                return -EACCES;
-            break;
-        case hflat::Metadata_ReachabilityType_UID_OR_GID:
-            if(fuse_get_context()->uid != e.uid())
-                if(fuse_get_context()->gid != e.gid())
-                    return -EACCES;
-            break;
-        case hflat::Metadata_ReachabilityType_NOT_GID:
-            if(fuse_get_context()->gid == e.gid())
-               return -EACCES;
-            break;
-        case hflat::Metadata_ReachabilityType_NOT_UID:
-            if(fuse_get_context()->uid == e.uid())
-                return -EACCES;
-            break;
-        case hflat::Metadata_ReachabilityType_GID_REQ_UID:
-            if(fuse_get_context()->gid == e.gid())
-                if(fuse_get_context()->uid != e.uid())
-                    return -EACCES;
-            break;
-        }
-    }
-    return 0;
-}
-
-
-int lookup(const char *user_path, std::shared_ptr<MetadataInfo> &mdi)
+/* Obtain metadata stored at the supplied system key from the lookup cache or the flat namespace. Metadata read in from
+ * the flat namespace is added to the lookup cache, HARDLINK_S inodes as a stub and FORCE_UPDATE inodes not at all. */
+static int lookup_key(const std::string &key, std::shared_ptr<MetadataInfo> &mdi)
 {
-    std::string key, value, version;
-    std::int64_t pathPermissionTimeStamp = 0;
-
-    /* Step 1: Transform user path to system path and obtain required path permission timestamp */
-    key = PRIV->pmap.toSystemPath(user_path, pathPermissionTimeStamp, CallingType::LOOKUP);
-    if (pathPermissionTimeStamp < 0)
-        return pathPermissionTimeStamp;
-
-    /* Step 2: Get metadata from flat namespace */
     bool cached = true;
     while(cached == true && PRIV->lookup_cache.get(key, mdi) == false)
         if(PRIV->lookup_cache.block(key))
             cached = false;
 
+    /* An expired cache entry can be revived if the metadata key didn't change, which is much cheaper than a Get. */
+    if(!cached && PRIV->lookup_cache.getExpired(key, mdi) && metadata_unchanged(mdi))
+        cached = PRIV->lookup_cache.revive(key);
+
     if(!cached){
         mdi.reset(new MetadataInfo(key));
         int err = get_metadata(mdi);
@@ -109,35 +64,92 @@ int lookup(const char *user_path, std::shared_ptr<MetadataInfo> &mdi)
     if(mdi->getMD().inode_number() == 0)
         return -ENOENT;
 
-    /* Step 3: Special inode types: Follow hardlink_source inode types in the lookup operation, update on force_update. */
-    if (mdi->getMD().type() == hflat::Metadata_InodeType_HARDLINK_S) {
-        if(!cached){
-            hflat_debug("type HARDLINK_S for user_path %s",user_path);
+    if(!cached){
+        if (mdi->getMD().type() == hflat::Metadata_InodeType_HARDLINK_S) {
+            hflat_debug("type HARDLINK_S for key %s",key.c_str());
             std::shared_ptr<MetadataInfo> mdi_source(new MetadataInfo(key));
+            mdi_source->setKeyVersion( mdi->getKeyVersion() );
             mdi_source->getMD().set_type( hflat::Metadata_InodeType_HARDLINK_S );
             mdi_source->getMD().set_inode_number( mdi->getMD().inode_number() );
             REQ_TRUE(PRIV->lookup_cache.add(key,mdi_source));
         }
-        std::string hlkey = "hardlink_" + std::to_string(mdi->getMD().inode_number());
-        return lookup(hlkey.c_str(), mdi);
+        else if (mdi->getMD().type() == hflat::Metadata_InodeType_FORCE_UPDATE)
+            PRIV->lookup_cache.invalidate(key);
+        else
+            REQ_TRUE(PRIV->lookup_cache.add(key,mdi));
+    }
+    return 0;
+}
+
+static std::string hardlink_key(std::uint64_t inode_number)
+{
+    return "hardlink_" + std::to_string(inode_number);
+}
+
+/* Obtain metadata stored at the supplied system key like lookup_key, following a HARDLINK_S inode to its HARDLINK_T
+ * inode. The hardlink key can't be remapped and requires no path permissions, so it is looked up directly.
+ *
+ * The cached HARDLINK_S stub is the resolution of a source key. If it has expired, the source most likely still
+ * forwards to the same inode: the target is fetched in parallel to verifying the source, so that resolving an
+ * uncached hardlink costs a single round trip. */
+static int lookup_resolve(const std::string &key, std::shared_ptr<MetadataInfo> &mdi)
+{
+    std::shared_ptr<MetadataInfo> expired, target;
+    std::uint64_t speculated = 0;
+    int err = 0, target_err = 0;
+
+    if (PRIV->lookup_cache.getExpired(key, expired) && expired->getMD().type() == hflat::Metadata_InodeType_HARDLINK_S) {
+        speculated = expired->getMD().inode_number();
+        PRIV->workers.run(2, 2, [&](std::size_t i){
+            if (i == 0) err = lookup_key(key, mdi);
+            else target_err = lookup_key(hardlink_key(speculated), target);
+            return 0;
+        });
+    }
+    else
+        err = lookup_key(key, mdi);
+    if (err || mdi->getMD().type() != hflat::Metadata_InodeType_HARDLINK_S)
+        return err;
 
+    if (mdi->getMD().inode_number() == speculated) {
+        mdi = target;
+        return target_err;
     }
+    return lookup_key(hardlink_key(mdi->getMD().inode_number()), mdi);
+}
+
+int lookup(const char *user_path, std::shared_ptr<MetadataInfo> &mdi)
+{
+    std::string key, value, version;
+    std::int64_t pathPermissionTimeStamp = 0;
+
+    /* Step 1: Transform user path to system path and obtain required path permission timestamp */
+    std::int64_t snapshotVersion = PRIV->pmap.getSnapshotVersion();
+    PRIV->pmap.toSystemPath(user_path, key, pathPermissionTimeStamp, CallingType::LOOKUP);
+    if (pathPermissionTimeStamp < 0)
+        return pathPermissionTimeStamp;
+
+    /* Step 2: Get metadata from flat namespace, following hardlink_source inode types. */
+    if (int err = lookup_resolve(key, mdi))
+        return err;
+
+    /* Step 3: Special inode types: update on force_update. */
     if (mdi->getMD().type() == hflat::Metadata_InodeType_FORCE_UPDATE) {
+        /* No need to wait for an update if the snapshot has been refreshed in the meantime. */
+        if (PRIV->pmap.getSnapshotVersion() > snapshotVersion)
+            return lookup(user_path, mdi);
         if (int err = util::database_update()){
             hflat_warning("encountered force_update inode in regular lookup and couldn't update database."
                     "user path: %s, system path: %s",user_path,mdi->getSystemPath().c_str());
-            PRIV->lookup_cache.invalidate(key);
             return err;
         }
-        PRIV->lookup_cache.invalidate(key);
         return lookup(user_path, mdi);
     }
 
-    if(!cached)
-        REQ_TRUE(PRIV->lookup_cache.add(key,mdi));
-
-    /* Step 4: check path permissions, update (recursively as necessary) in case of staleness */
-    bool stale = mdi->getMD().path_permission_verified() < pathPermissionTimeStamp;
+    /* Step 4: check path permissions, update (recursively as necessary) in case of staleness. Path permissions of
+     * hardlink targets are not tied to a single path and never stale. */
+    bool stale = mdi->getMD().type() != hflat::Metadata_InodeType_HARDLINK_T &&
+            mdi->getMD().path_permission_verified() < pathPermissionTimeStamp;
     if (stale) {
         hflat_debug("stale path permission for path %s (%d vs required %d )",user_path, mdi->getMD().path_permission_verified(), pathPermissionTimeStamp);
         std::shared_ptr<MetadataInfo> mdi_parent;
@@ -149,10 +161,43 @@ int lookup(const char *user_path, std::shared_ptr<MetadataInfo> &mdi)
         if (err == -EAGAIN ) return lookup(user_path, mdi);
         if (err) return err;
     }
-    return check_path_permissions(mdi->getMD().path_permission());
+    return mdi->checkPathPermissions(hflat_get_context()->uid, hflat_get_context()->gid);
 }
 
 
+/* Lookup metadata of an open file using its system key, skipping path resolution and path permission checks which
+ * have been done when the file was opened. Falls back to a regular lookup if no file handle is available, the user
+ * path may be null if it is unknown (-ESTALE). */
+int lookup_open_file(const char *user_path, struct fuse_file_info *fi, std::shared_ptr<MetadataInfo> &mdi)
+{
+    OpenFile *file = fi ? reinterpret_cast<OpenFile *>(fi->fh) : nullptr;
+    if (!file)
+        return user_path ? lookup(user_path, mdi) : -ESTALE;
+
+    std::string key;
+    if (!PRIV->open_files.get(*file, key, mdi))
+        return mdi ? 0 : user_path ? lookup(user_path, mdi) : -ESTALE;
+
+    std::shared_ptr<MetadataInfo> current;
+    int err = lookup_key(key, current);
+
+    /* The file has been hardlinked since it was opened. */
+    if (!err && current->getMD().type() == hflat::Metadata_InodeType_HARDLINK_S && current->getMD().inode_number() == file->inode_number) {
+        key = hardlink_key(file->inode_number);
+        err = lookup_key(key, current);
+    }
+    if (err && err != -ENOENT)
+        return err;
+
+    /* If the key no longer refers to the open file it has been moved or removed by another client, continue using
+     * the last known metadata. */
+    if (!err && current->getMD().inode_number() == file->inode_number) {
+        PRIV->open_files.update(*file, key, current);
+        mdi = current;
+    }
+    return 0;
+}
+
 /* Lookup parent directory of supplied user path. */
 int lookup_parent(const char *user_path, std::shared_ptr<MetadataInfo> &mdi_parent)
 {
@@ -170,5 +215,5 @@ int lookup_parent(const char *user_path, std::shared_ptr<MetadataInfo> &mdi_pare
     if (!S_ISDIR(mdi_parent->getMD().mode()))
         return -ENOTDIR;
 
-    return check_path_permissions(mdi_parent->getMD().path_permission_children());
+    return mdi_parent->checkPathPermissionChildren(hflat_get_context()->uid, hflat_get_context()->gid);
 }
@@ -0,0 +1,814 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "main.h"
+#include "debug.h"
+#include "fuseops.h"
+#include <fuse/fuse_lowlevel.h>
+#include <unordered_map>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <sys/param.h>
+
+/* Low-level (inode based) frontend. The kernel identifies inodes by node ids, which are mapped to the user path
+ * and the most recently obtained metadata of the inode. Entries and attributes are returned with a timeout equal
+ * to the cache expiration, so that repeated lookups are answered by the kernel dcache instead of the file system.
+ * File system operations themselves are executed by the path based operations, compare fuseops.h. */
+
+using std::chrono::steady_clock;
+using std::chrono::milliseconds;
+
+namespace {
+
+class NodeTable final
+{
+private:
+    struct Node
+    {
+        std::string                   path;
+        std::uint64_t                 nlookup;
+        std::shared_ptr<MetadataInfo> mdi;
+        steady_clock::time_point      validated;
+    };
+
+    std::unordered_map<fuse_ino_t, Node>        nodes;
+    std::unordered_map<std::string, fuse_ino_t> ids;
+    fuse_ino_t                                  next_id;
+    std::mutex                                  lock;
+
+    /* kernel dentry invalidation is asynchronous, it may not be called in the execution path of a request */
+    std::deque<std::string>   invalidations;
+    std::condition_variable   invalidations_pending;
+    std::thread               notifier;
+    bool                      shutdown;
+
+public:
+    NodeTable() : next_id(FUSE_ROOT_ID + 1), shutdown(false)
+    {
+        Node root = { "/", 1, nullptr, steady_clock::time_point() };
+        nodes[FUSE_ROOT_ID] = root;
+        ids["/"] = FUSE_ROOT_ID;
+    }
+
+    /* Register a lookup of the supplied path, returns the node id. */
+    fuse_ino_t remember(const std::string &path, const std::shared_ptr<MetadataInfo> &mdi)
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        auto it = ids.find(path);
+        fuse_ino_t id = it == ids.end() ? next_id++ : it->second;
+
+        Node &n = nodes[id];
+        if (it == ids.end()) {
+            n.path = path;
+            n.nlookup = 0;
+            ids[path] = id;
+        }
+        n.nlookup++;
+        n.mdi = mdi;
+        n.validated = steady_clock::now();
+        return id;
+    }
+
+    void forget(fuse_ino_t id, unsigned long nlookup)
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        auto it = nodes.find(id);
+        if (it == nodes.end() || id == FUSE_ROOT_ID)
+            return;
+        if (it->second.nlookup > nlookup) {
+            it->second.nlookup -= nlookup;
+            return;
+        }
+        auto pit = ids.find(it->second.path);
+        if (pit != ids.end() && pit->second == id)
+            ids.erase(pit);
+        nodes.erase(it);
+    }
+
+    /* Obtain path of a node. Metadata is supplied if it has been validated during the last cache_expiration_ms. */
+    bool get(fuse_ino_t id, std::string &path, std::shared_ptr<MetadataInfo> &mdi)
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        auto it = nodes.find(id);
+        if (it == nodes.end())
+            return false;
+        path = it->second.path;
+        if (it->second.mdi && steady_clock::now() - it->second.validated < milliseconds(PRIV->options.cache_expiration_ms))
+            mdi = it->second.mdi;
+        return true;
+    }
+
+    void validated(fuse_ino_t id, const std::shared_ptr<MetadataInfo> &mdi)
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        auto it = nodes.find(id);
+        if (it == nodes.end())
+            return;
+        it->second.mdi = mdi;
+        it->second.validated = steady_clock::now();
+    }
+
+    /* The path no longer refers to the node, the node itself is kept until forgotten by the kernel. */
+    void unlinked(const std::string &path)
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        ids.erase(path);
+    }
+
+    /* Move the node of the supplied path and all nodes below it. */
+    void renamed(const std::string &from, const std::string &to)
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        ids.erase(to);
+        for (auto &n : nodes) {
+            std::string &path = n.second.path;
+            if (path.compare(0, from.size(), from) || (path.size() > from.size() && path[from.size()] != '/'))
+                continue;
+            auto it = ids.find(path);
+            if (it != ids.end() && it->second == n.first)
+                ids.erase(it);
+            path.replace(0, from.size(), to);
+            ids[path] = n.first;
+        }
+    }
+
+    /* Queue kernel dentry invalidation of a path that has been changed by another client. */
+    void invalidate(const std::string &path)
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        invalidations.push_back(path);
+        invalidations_pending.notify_one();
+    }
+
+    void start(struct fuse_chan *ch)
+    {
+        notifier = std::thread([this, ch](){
+            std::unique_lock<std::mutex> locker(lock);
+            while (!shutdown) {
+                if (invalidations.empty()) {
+                    invalidations_pending.wait(locker);
+                    continue;
+                }
+                std::string path = invalidations.front();
+                invalidations.pop_front();
+
+                auto pos = path.find_last_of('/');
+                if (pos == std::string::npos || pos + 1 == path.size())
+                    continue;
+                auto it = ids.find(pos ? path.substr(0, pos) : std::string("/"));
+                if (it == ids.end())
+                    continue;
+                fuse_ino_t parent = it->second;
+
+                locker.unlock();
+                int err = fuse_lowlevel_notify_inval_entry(ch, parent, path.c_str() + pos + 1, path.size() - pos - 1);
+                if (err && err != -ENOENT)
+                    hflat_debug("failed invalidating kernel dentry for path %s: %d", path.c_str(), err);
+                locker.lock();
+            }
+        });
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> locker(lock);
+            shutdown = true;
+            invalidations_pending.notify_one();
+        }
+        if (notifier.joinable())
+            notifier.join();
+    }
+};
+
+/* Reply buffer of a readdir request, filled by the path based readdir. */
+struct DirBuffer
+{
+    fuse_req_t          req;
+    std::vector<char>   data;
+    size_t              used;
+};
+
+NodeTable         nodetable;
+void             *private_data = nullptr;
+struct fuse_chan *channel      = nullptr;
+
+/* Set the context of the path based operations for the duration of a request. */
+class RequestContext final
+{
+private:
+    struct fuse_context context;
+
+public:
+    explicit RequestContext(fuse_req_t req)
+    {
+        const struct fuse_ctx *ctx = fuse_req_ctx(req);
+        context.fuse = nullptr;
+        context.uid = ctx->uid;
+        context.gid = ctx->gid;
+        context.pid = ctx->pid;
+        context.umask = ctx->umask;
+        context.private_data = private_data;
+        hflat_set_context(&context);
+    }
+    ~RequestContext()
+    {
+        hflat_set_context(nullptr);
+    }
+};
+
+double timeout()
+{
+    return PRIV->options.cache_expiration_ms / 1000.0;
+}
+
+std::string child_path(const std::string &parent, const char *name)
+{
+    if (parent == "/")
+        return parent + name;
+    return parent + "/" + name;
+}
+
+/* Obtain attributes of the supplied path. Metadata with outstanding writes is flushed first, compare hflat_getattr. */
+int attributes(const std::string &path, struct stat *attr, std::shared_ptr<MetadataInfo> &mdi)
+{
+    memset(attr, 0, sizeof(struct stat));
+    if (int err = lookup(path.c_str(), mdi))
+        return err;
+    if (mdi->getDirtyData() && mdi->getDirtyData()->hasUpdates())
+        return hflat_getattr(path.c_str(), attr);
+    metadata_to_stat(mdi, attr);
+    return 0;
+}
+
+/* Obtain the entry for the supplied path. */
+int entry(const std::string &path, struct fuse_entry_param &e)
+{
+    std::shared_ptr<MetadataInfo> mdi;
+    memset(&e, 0, sizeof(e));
+    e.attr_timeout = timeout();
+    e.entry_timeout = timeout();
+
+    int err = attributes(path, &e.attr, mdi);
+    if (!err)
+        e.ino = nodetable.remember(path, mdi);
+    return err;
+}
+
+/* Reply the entry for the supplied path. Only lookups may reply a negative entry if the path doesn't exist, an entry
+ * created by the request itself might have been removed concurrently. */
+void reply_entry(fuse_req_t req, const std::string &path, bool negative = false)
+{
+    struct fuse_entry_param e;
+    int err = entry(path, e);
+
+    /* non-existing entries are cached by the kernel as negative entries */
+    if (err && !(negative && err == -ENOENT))
+        fuse_reply_err(req, -err);
+    else
+        fuse_reply_entry(req, &e);
+}
+
+void reply_result(fuse_req_t req, int err)
+{
+    fuse_reply_err(req, err < 0 ? -err : 0);
+}
+
+/* Obtain the path of a node, replies ESTALE for unknown nodes. */
+bool node_path(fuse_req_t req, fuse_ino_t ino, std::string &path)
+{
+    std::shared_ptr<MetadataInfo> mdi;
+    if (nodetable.get(ino, path, mdi))
+        return true;
+    fuse_reply_err(req, ESTALE);
+    return false;
+}
+
+
+void ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+    struct fuse_context context;
+    memset(&context, 0, sizeof(context));
+    hflat_set_context(&context);
+    private_data = hflat_init(conn);
+    PRIV->invalidate_entry = [](const std::string &user_path){ nodetable.invalidate(user_path); };
+    hflat_set_context(nullptr);
+    nodetable.start(channel);
+}
+
+void ll_destroy(void *userdata)
+{
+    nodetable.stop();
+    struct fuse_context context;
+    memset(&context, 0, sizeof(context));
+    context.private_data = private_data;
+    hflat_set_context(&context);
+    hflat_destroy(private_data);
+    hflat_set_context(nullptr);
+}
+
+void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, parent, path)) return;
+    reply_entry(req, child_path(path, name), true);
+}
+
+void ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+    nodetable.forget(ino, nlookup);
+    fuse_reply_none(req);
+}
+
+void ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    RequestContext rc(req);
+    std::string path;
+    std::shared_ptr<MetadataInfo> mdi;
+    struct stat attr;
+    if (!nodetable.get(ino, path, mdi)) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+
+    /* Recently validated metadata can be used directly, as long as the path permissions allow it. */
+    if (mdi && !(mdi->getDirtyData() && mdi->getDirtyData()->hasUpdates()) &&
+            mdi->checkPathPermissions(hflat_get_context()->uid, hflat_get_context()->gid) == 0) {
+        memset(&attr, 0, sizeof(attr));
+        metadata_to_stat(mdi, &attr);
+        fuse_reply_attr(req, &attr, timeout());
+        return;
+    }
+
+    if (int err = attributes(path, &attr, mdi)) {
+        fuse_reply_err(req, -err);
+        return;
+    }
+    nodetable.validated(ino, mdi);
+    fuse_reply_attr(req, &attr, timeout());
+}
+
+void ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) return;
+    int err = 0;
+
+    if (!err && (to_set & FUSE_SET_ATTR_MODE))
+        err = hflat_chmod(path.c_str(), attr->st_mode);
+    if (!err && (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)))
+        err = hflat_chown(path.c_str(), (to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : (uid_t) -1,
+                                        (to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : (gid_t) -1);
+    if (!err && (to_set & FUSE_SET_ATTR_SIZE))
+        err = fi ? hflat_ftruncate(path.c_str(), attr->st_size, fi) : hflat_truncate(path.c_str(), attr->st_size);
+    if (!err && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))) {
+        struct stat current;
+        std::shared_ptr<MetadataInfo> mdi;
+        err = attributes(path, &current, mdi);
+
+        struct timespec tv[2];
+        std::time_t now = std::time(nullptr);
+        tv[0].tv_nsec = tv[1].tv_nsec = 0;
+        tv[0].tv_sec = (to_set & FUSE_SET_ATTR_ATIME) ? ((to_set & FUSE_SET_ATTR_ATIME_NOW) ? now : attr->st_atime) : current.st_atime;
+        tv[1].tv_sec = (to_set & FUSE_SET_ATTR_MTIME) ? ((to_set & FUSE_SET_ATTR_MTIME_NOW) ? now : attr->st_mtime) : current.st_mtime;
+        if (!err)
+            err = hflat_utimens(path.c_str(), tv);
+    }
+    if (err) {
+        fuse_reply_err(req, -err);
+        return;
+    }
+
+    struct stat updated;
+    std::shared_ptr<MetadataInfo> mdi;
+    if ((err = attributes(path, &updated, mdi))) {
+        fuse_reply_err(req, -err);
+        return;
+    }
+    nodetable.validated(ino, mdi);
+    fuse_reply_attr(req, &updated, timeout());
+}
+
+void ll_readlink(fuse_req_t req, fuse_ino_t ino)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) return;
+    char buffer[PATH_MAX + 1];
+
+    if (int err = hflat_readlink(path.c_str(), buffer, sizeof(buffer)))
+        fuse_reply_err(req, -err);
+    else
+        fuse_reply_readlink(req, buffer);
+}
+
+void ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, parent, path)) return;
+    std::string child = child_path(path, name);
+
+    if (int err = hflat_mknod(child.c_str(), mode, rdev))
+        fuse_reply_err(req, -err);
+    else
+        reply_entry(req, child);
+}
+
+void ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, parent, path)) return;
+    std::string child = child_path(path, name);
+
+    if (int err = hflat_mkdir(child.c_str(), mode))
+        fuse_reply_err(req, -err);
+    else
+        reply_entry(req, child);
+}
+
+void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, parent, path)) return;
+    std::string child = child_path(path, name);
+
+    int err = hflat_unlink(child.c_str());
+    if (!err)
+        nodetable.unlinked(child);
+    reply_result(req, err);
+}
+
+void ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, parent, path)) return;
+    std::string child = child_path(path, name);
+
+    int err = hflat_rmdir(child.c_str());
+    if (!err)
+        nodetable.unlinked(child);
+    reply_result(req, err);
+}
+
+void ll_symlink(fuse_req_t req, const char *link, fuse_ino_t parent, const char *name)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, parent, path)) return;
+    std::string child = child_path(path, name);
+
+    if (int err = hflat_symlink(link, child.c_str()))
+        fuse_reply_err(req, -err);
+    else
+        reply_entry(req, child);
+}
+
+void ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname)
+{
+    RequestContext rc(req);
+    std::string path, newpath;
+    if (!node_path(req, parent, path) || !node_path(req, newparent, newpath)) return;
+    std::string from = child_path(path, name);
+    std::string to   = child_path(newpath, newname);
+
+    int err = hflat_rename(from.c_str(), to.c_str());
+    if (!err)
+        nodetable.renamed(from, to);
+    reply_result(req, err);
+}
+
+void ll_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char *newname)
+{
+    RequestContext rc(req);
+    std::string path, newpath;
+    if (!node_path(req, ino, path) || !node_path(req, newparent, newpath)) return;
+    std::string child = child_path(newpath, newname);
+
+    if (int err = hflat_hardlink(path.c_str(), child.c_str()))
+        fuse_reply_err(req, -err);
+    else
+        reply_entry(req, child);
+}
+
+void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) return;
+
+    if (int err = hflat_open(path.c_str(), fi))
+        fuse_reply_err(req, -err);
+    else
+        fuse_reply_open(req, fi);
+}
+
+void ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, parent, path)) return;
+    std::string child = child_path(path, name);
+
+    int err = hflat_fcreate(child.c_str(), mode, fi);
+    struct fuse_entry_param e;
+    if (!err && (err = entry(child, e)))
+        hflat_release(child.c_str(), fi);
+    if (err)
+        fuse_reply_err(req, -err);
+    else
+        fuse_reply_create(req, &e, fi);
+}
+
+void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) return;
+    std::vector<char> buffer(size);
+
+    int rtn = hflat_read(path.c_str(), buffer.data(), size, off, fi);
+    if (rtn < 0)
+        fuse_reply_err(req, -rtn);
+    else
+        fuse_reply_buf(req, buffer.data(), rtn);
+}
+
+void ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) return;
+
+    int rtn = hflat_write(path.c_str(), buf, size, off, fi);
+    if (rtn < 0)
+        fuse_reply_err(req, -rtn);
+    else
+        fuse_reply_write(req, rtn);
+}
+
+void ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) return;
+    reply_result(req, hflat_flush(path.c_str(), fi));
+}
+
+void ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    RequestContext rc(req);
+    std::string path;
+    /* The open file is known by its handle, it can be flushed and released without a path. */
+    if (!node_path(req, ino, path)) {
+        hflat_release(nullptr, fi);
+        return;
+    }
+    reply_result(req, hflat_release(path.c_str(), fi));
+}
+
+void ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) return;
+    reply_result(req, hflat_fsync(path.c_str(), datasync, fi));
+}
+
+int fill_dir(void *buffer, const char *name, const struct stat *attr, off_t offset)
+{
+    DirBuffer *db = static_cast<DirBuffer *>(buffer);
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    if (attr)
+        st = *attr;
+    size_t len = fuse_add_direntry(db->req, db->data.data() + db->used, db->data.size() - db->used, name, &st, offset);
+    if (len > db->data.size() - db->used)
+        return 1;
+    db->used += len;
+    return 0;
+}
+
+void ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) return;
+
+    if (int err = hflat_opendir(path.c_str(), fi)) {
+        fuse_reply_err(req, -err);
+        return;
+    }
+    fuse_reply_open(req, fi);
+}
+
+void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) return;
+
+    DirBuffer db{req, std::vector<char>(size), 0};
+    if (int err = hflat_readdir(path.c_str(), &db, fill_dir, off, fi)) {
+        fuse_reply_err(req, -err);
+        return;
+    }
+    fuse_reply_buf(req, db.data.data(), db.used);
+}
+
+void ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) {
+        hflat_releasedir(nullptr, fi);
+        return;
+    }
+    reply_result(req, hflat_releasedir(path.c_str(), fi));
+}
+
+void ll_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) return;
+    reply_result(req, hflat_fsyncdir(path.c_str(), datasync, fi));
+}
+
+void ll_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+    RequestContext rc(req);
+    struct statvfs s;
+    memset(&s, 0, sizeof(s));
+
+    if (int err = hflat_statfs("/", &s))
+        fuse_reply_err(req, -err);
+    else
+        fuse_reply_statfs(req, &s);
+}
+
+#ifdef __APPLE__
+void ll_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name, const char *value, size_t size, int flags, uint32_t position)
+#else
+void ll_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name, const char *value, size_t size, int flags)
+#endif
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) return;
+#ifdef __APPLE__
+    reply_result(req, hflat_setxattr_apple(path.c_str(), name, value, size, flags, position));
+#else
+    reply_result(req, hflat_setxattr(path.c_str(), name, value, size, flags));
+#endif
+}
+
+/* Size queries (size 0) are answered with fuse_reply_xattr, everything else with the supplied buffer. */
+void reply_xattr(fuse_req_t req, size_t size, int rtn, const std::vector<char> &buffer)
+{
+    if (rtn < 0)
+        fuse_reply_err(req, -rtn);
+    else if (!size)
+        fuse_reply_xattr(req, rtn);
+    else
+        fuse_reply_buf(req, buffer.data(), rtn);
+}
+
+#ifdef __APPLE__
+void ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size, uint32_t position)
+#else
+void ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size)
+#endif
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) return;
+    std::vector<char> buffer(size);
+#ifdef __APPLE__
+    int rtn = hflat_getxattr_apple(path.c_str(), name, buffer.data(), size, position);
+#else
+    int rtn = hflat_getxattr(path.c_str(), name, buffer.data(), size);
+#endif
+    reply_xattr(req, size, rtn, buffer);
+}
+
+void ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) return;
+    std::vector<char> buffer(size);
+    reply_xattr(req, size, hflat_listxattr(path.c_str(), buffer.data(), size), buffer);
+}
+
+void ll_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) return;
+    reply_result(req, hflat_removexattr(path.c_str(), name));
+}
+
+void ll_access(fuse_req_t req, fuse_ino_t ino, int mask)
+{
+    RequestContext rc(req);
+    std::string path;
+    if (!node_path(req, ino, path)) return;
+    reply_result(req, hflat_access(path.c_str(), mask));
+}
+
+void init_lowlevel_ops(fuse_lowlevel_ops *ops)
+{
+    ops->init = ll_init;
+    ops->destroy = ll_destroy;
+    ops->lookup = ll_lookup;
+    ops->forget = ll_forget;
+
+    ops->getattr = ll_getattr;
+    ops->setattr = ll_setattr;
+    ops->access = ll_access;
+    ops->statfs = ll_statfs;
+
+    ops->mknod = ll_mknod;
+    ops->create = ll_create;
+    ops->unlink = ll_unlink;
+    ops->open = ll_open;
+    ops->release = ll_release;
+
+    ops->mkdir = ll_mkdir;
+    ops->rmdir = ll_rmdir;
+    ops->opendir = ll_opendir;
+    ops->readdir = ll_readdir;
+    ops->releasedir = ll_releasedir;
+    ops->fsyncdir = ll_fsyncdir;
+
+    ops->symlink = ll_symlink;
+    ops->readlink = ll_readlink;
+    ops->link = ll_link;
+    ops->rename = ll_rename;
+
+    ops->read = ll_read;
+    ops->write = ll_write;
+    ops->flush = ll_flush;
+    ops->fsync = ll_fsync;
+
+    ops->setxattr = ll_setxattr;
+    ops->getxattr = ll_getxattr;
+    ops->listxattr = ll_listxattr;
+    ops->removexattr = ll_removexattr;
+}
+
+}
+
+int hflat_lowlevel_main(int argc, char *argv[])
+{
+    struct fuse_lowlevel_ops ops;
+    memset(&ops, 0, sizeof(ops));
+    init_lowlevel_ops(&ops);
+
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    char *mountpoint = nullptr;
+    int multithreaded = 0, foreground = 0;
+    int err = -1;
+
+    if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) != -1 && mountpoint) {
+        if ((channel = fuse_mount(mountpoint, &args))) {
+            struct fuse_session *se = fuse_lowlevel_new(&args, &ops, sizeof(ops), nullptr);
+            if (se) {
+                if (fuse_set_signal_handlers(se) != -1) {
+                    fuse_session_add_chan(se, channel);
+                    fuse_daemonize(foreground);
+                    err = multithreaded ? fuse_session_loop_mt(se) : fuse_session_loop(se);
+                    fuse_remove_signal_handlers(se);
+                    fuse_session_remove_chan(channel);
+                }
+                fuse_session_destroy(se);
+            }
+            fuse_unmount(mountpoint, channel);
+        }
+    }
+    fuse_opt_free_args(&args);
+    free(mountpoint);
+    return err ? 1 : 0;
+}
@@ -21,111 +21,310 @@
 #include <condition_variable>
 #include <mutex>
 #include <list>
+#include <vector>
+#include <memory>
+#include <functional>
 #include <chrono>
+#include <algorithm>
+#include <cstdint>
 
 
 using namespace std::chrono;
 
+/* Approximate access frequencies of keys (count-min sketch with 4 bit counters), used for TinyLFU style cache admission.
+ * All counters are halved after a sample period, so that the sketch follows changes of the working set. */
+class FrequencySketch final {
+private:
+    static const int depth = 4;
+    std::vector<std::uint8_t> counters;
+    std::uint64_t             mask;
+    std::uint32_t             additions;
+    std::uint32_t             sample_size;
+
+private:
+    std::size_t index(std::uint64_t hash, int row) const {
+        hash += (row + 1) * 0x9E3779B97F4A7C15ULL;
+        hash  = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        hash  = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+        return row * (mask + 1) + ((hash ^ (hash >> 31)) & mask);
+    }
+
+public:
+    void increment(std::uint64_t hash){
+        for(int row = 0; row < depth; row++){
+            std::uint8_t &c = counters[index(hash, row)];
+            if(c < 15) c++;
+        }
+        if(++additions >= sample_size){
+            for(auto &c : counters) c >>= 1;
+            additions /= 2;
+        }
+    }
+    std::uint8_t frequency(std::uint64_t hash) const {
+        std::uint8_t f = 15;
+        for(int row = 0; row < depth; row++)
+            f = std::min(f, counters[index(hash, row)]);
+        return f;
+    }
+
+public:
+    explicit FrequencySketch(std::uint32_t width) : counters(), mask(1), additions(0), sample_size(0) {
+        while(mask + 1 < width) mask = (mask << 1) | 1;
+        counters.resize(depth * (mask + 1), 0);
+        sample_size = 10 * (mask + 1);
+    }
+};
+
+
 /* A threadsafe LRU cache with optional auto-expiration of cache elements.
  * Use std::shared_ptr as data elements for a non-owning cache (probably a good idea in multithread environments).
- * Note that the dirty property overrides item expiration (a non-removable item will never be considered expired). */
+ * Note that the dirty property overrides item expiration (a non-removable item will never be considered expired).
+ *
+ * The cache is split into independently locked shards, a key is always handled by the shard selected by its hash.
+ * Each shard keeps its own LRU lists and set of blocked keys, so threads accessing different keys rarely contend.
+ *
+ * Capacity is a memory budget, the memory used by an element is computed by the supplied cost function when it is
+ * added. If an element changes size afterwards, its owner has to call updateCost() while the element is consistent.
+ * Eviction follows W-TinyLFU: New elements enter a small window, elements leaving the window are only admitted to the
+ * main cache if they have been accessed more frequently than the element they would replace. One-time accesses
+ * (e.g. a find or ls -R run) therefore do not flush the working set. Elements found dirty during eviction are
+ * moved to a separate list, so eviction never has to skip over them repeatedly. */
 template< typename Key, typename Data > class LRUcache final {
 
 private:
-    typedef std::pair< Data, steady_clock::time_point > cache_entry;
+    enum Segment { WINDOW = 0, MAIN = 1, DIRTY = 2 };
 
-    std::list<cache_entry> cache;
-    std::unordered_map<Key, typename std::list<cache_entry>::iterator > lookup;
+    struct cache_entry {
+        Key                         key;
+        Data                        data;
+        steady_clock::time_point    time;
+        std::size_t                 cost;
+        Segment                     segment;
+        cache_entry(const Key &k, const Data &d, std::size_t c) : key(k), data(d), time(steady_clock::now()), cost(c), segment(WINDOW) {};
+    };
+    typedef typename std::list<cache_entry>::iterator entry_iterator;
 
-    std::unordered_set<Key> blocked_keys;
-    std::condition_variable unblocked;
+    struct Shard {
+        std::list<cache_entry> lists[3];
+        std::size_t            used[3];
+        std::unordered_map<Key, entry_iterator> lookup;
+        FrequencySketch        sketch;
+
+        std::unordered_set<Key> blocked_keys;
+        std::condition_variable unblocked;
+        std::mutex              mutex;
+
+        Shard() : lookup(), sketch(1024), blocked_keys() { used[WINDOW] = used[MAIN] = used[DIRTY] = 0; };
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
 
     milliseconds        expiration_time;
-    std::uint32_t       capacity;
-    std::mutex          mutex;
+    std::size_t         window_capacity;   // per shard
+    std::size_t         main_capacity;     // per shard
 
-    std::function<const Key(const Data&)> getKey;
+    std::function<std::size_t(const Data&)> cost;
     std::function<bool(const Data&)> dirty;
 
 private:
-    bool expired(typename std::list<cache_entry>::iterator it){
+    Shard & shard(std::size_t hash){
+        return *shards[hash % shards.size()];
+    }
+    bool expired(entry_iterator it){
         // dirty elements cannot be expired from the cache
-        if(dirty(it->first)) return false;
+        if(dirty(it->data)) return false;
         // an item is considered expired if it has been in the cache for longer than expiration_time
-        return expiration_time.count() && (duration_cast<milliseconds>(steady_clock::now() - it->second) > expiration_time);
+        return expiration_time.count() && (duration_cast<milliseconds>(steady_clock::now() - it->time) > expiration_time);
+    }
+    void move(Shard &s, entry_iterator it, Segment to){
+        s.used[it->segment] -= it->cost;
+        s.lists[to].splice(s.lists[to].begin(), s.lists[it->segment], it);
+        s.used[to] += it->cost;
+        it->segment = to;
+    }
+    void remove(Shard &s, entry_iterator it){
+        s.used[it->segment] -= it->cost;
+        s.lookup.erase(it->key);
+        s.lists[it->segment].erase(it);
     }
-    void remove(const Key &k){
-        cache.erase(lookup[k]);
-        lookup.erase(k);
+    /* Mark element as recently used. */
+    void touch(Shard &s, entry_iterator it){
+        move(s, it, it->segment == DIRTY && !dirty(it->data) ? MAIN : it->segment);
+    }
+    /* Evict elements until the window and main lists fit their capacity. Every step either evicts or moves an
+     * element to another list, elements only return to the dirty list after being used again. */
+    void reclaim(Shard &s){
+        /* Give the oldest dirty element a chance to be evictable again. */
+        if(!s.lists[DIRTY].empty() && !dirty(s.lists[DIRTY].back().data))
+            move(s, --s.lists[DIRTY].end(), MAIN);
+
+        /* The most recently added element always stays in the window. */
+        while(s.used[WINDOW] > window_capacity && s.lists[WINDOW].size() > 1){
+            entry_iterator candidate = --s.lists[WINDOW].end();
+            if(dirty(candidate->data)){
+                move(s, candidate, DIRTY);
+                continue;
+            }
+            move(s, candidate, MAIN);
+            while(s.used[MAIN] > main_capacity){
+                entry_iterator victim = --s.lists[MAIN].end();
+                if(victim == candidate)
+                    break;
+                if(dirty(victim->data)){
+                    move(s, victim, DIRTY);
+                    continue;
+                }
+                if(s.sketch.frequency(std::hash<Key>()(candidate->key)) > s.sketch.frequency(std::hash<Key>()(victim->key)))
+                    remove(s, victim);
+                else{
+                    remove(s, candidate);
+                    break;
+                }
+            }
+        }
+        /* Costs of elements in the main list can grow after they have been admitted. */
+        while(s.used[MAIN] > main_capacity && !s.lists[MAIN].empty()){
+            entry_iterator victim = --s.lists[MAIN].end();
+            if(dirty(victim->data)) move(s, victim, DIRTY);
+            else remove(s, victim);
+        }
     }
 
 public:
     bool __attribute__((warn_unused_result)) get(const Key& k, Data& d){
-        std::unique_lock<std::mutex> locker(mutex);
+        std::size_t hash = std::hash<Key>()(k);
+        Shard &s = shard(hash);
+        std::unique_lock<std::mutex> locker(s.mutex);
 
-        while(blocked_keys.count(k))
-            unblocked.wait(locker);
+        while(s.blocked_keys.count(k))
+            s.unblocked.wait(locker);
 
-        if(lookup.count(k) == 0)
+        s.sketch.increment(hash);
+        auto it = s.lookup.find(k);
+        if(it == s.lookup.end())
             return false;
 
-        if(expired(lookup[k])){
-            remove(k);
+        /* Expired elements are kept, so that they can be revived if they turn out to be still valid. */
+        if(expired(it->second))
             return false;
-        }
-        cache.splice( cache.begin(), cache, lookup[k] );
-        d = lookup[k]->first;
+
+        touch(s, it->second);
+        d = it->second->data;
+        return true;
+    }
+
+    /* Obtain an expired element. Intended to be called by the thread that blocked the key after get() failed,
+     * see revive(). */
+    bool __attribute__((warn_unused_result)) getExpired(const Key& k, Data& d){
+        Shard &s = shard(std::hash<Key>()(k));
+        std::unique_lock<std::mutex> locker(s.mutex);
+
+        auto it = s.lookup.find(k);
+        if(it == s.lookup.end() || !expired(it->second))
+            return false;
+        d = it->second->data;
+        return true;
+    }
+
+    /* Reset the expiration time of an element that has been verified to be still valid and unblock its key.
+     * Returns false if the element is no longer cached, the key then stays blocked so that the caller can fetch
+     * the element and add() it. */
+    bool revive(const Key& k){
+        Shard &s = shard(std::hash<Key>()(k));
+        std::unique_lock<std::mutex> locker(s.mutex);
+
+        auto it = s.lookup.find(k);
+        if(it == s.lookup.end())
+            return false;
+        it->second->time = steady_clock::now();
+        touch(s, it->second);
+        if(s.blocked_keys.erase(k))
+            s.unblocked.notify_all();
         return true;
     }
 
     bool __attribute__((warn_unused_result)) add(const Key& k, Data& d){
-        std::unique_lock<std::mutex> locker(mutex);
+        Shard &s = shard(std::hash<Key>()(k));
+        std::unique_lock<std::mutex> locker(s.mutex);
 
-        if(lookup.count(k) > 0){
-            if(expired(lookup[k])) remove(k);
+        auto it = s.lookup.find(k);
+        if(it != s.lookup.end()){
+            if(expired(it->second)) remove(s, it->second);
             else return false;
         }
 
-        for (auto it = cache.rbegin(); it!=cache.rend() && cache.size() >= capacity; ++it){
-            if(!dirty(it->first))
-                remove(getKey(it->first));
-        }
-
-        cache.push_front(cache_entry(d, steady_clock::now()));
-        lookup[k] = cache.begin();
+        s.lists[WINDOW].push_front(cache_entry(k, d, cost(d)));
+        s.used[WINDOW] += s.lists[WINDOW].front().cost;
+        s.lookup[k] = s.lists[WINDOW].begin();
+        reclaim(s);
 
-        if(blocked_keys.erase(k))
-            unblocked.notify_all();
+        if(s.blocked_keys.erase(k))
+            s.unblocked.notify_all();
         return true;
     }
 
     bool __attribute__((warn_unused_result)) block(const Key &k){
-        std::unique_lock<std::mutex> locker(mutex);
-        return blocked_keys.insert(k).second;
+        Shard &s = shard(std::hash<Key>()(k));
+        std::unique_lock<std::mutex> locker(s.mutex);
+        return s.blocked_keys.insert(k).second;
     }
 
     void revalidate(const Key& k){
-        std::unique_lock<std::mutex> locker(mutex);
-        if(lookup.count(k) > 0)
-            lookup[k]->second = steady_clock::now();
+        Shard &s = shard(std::hash<Key>()(k));
+        std::unique_lock<std::mutex> locker(s.mutex);
+        auto it = s.lookup.find(k);
+        if(it != s.lookup.end()){
+            it->second->time = steady_clock::now();
+            touch(s, it->second);
+        }
+    }
+
+    /* Recompute the memory cost of an element after it changed size. The caller has to ensure that the element is not
+     * modified concurrently. */
+    void updateCost(const Key& k){
+        Shard &s = shard(std::hash<Key>()(k));
+        std::unique_lock<std::mutex> locker(s.mutex);
+        auto it = s.lookup.find(k);
+        if(it == s.lookup.end())
+            return;
+        s.used[it->second->segment] -= it->second->cost;
+        it->second->cost = cost(it->second->data);
+        s.used[it->second->segment] += it->second->cost;
+        reclaim(s);
     }
 
     void invalidate(const Key& k){
-        std::unique_lock<std::mutex> locker(mutex);
-        if(lookup.count(k) > 0)
-            remove(k);
-        if(blocked_keys.erase(k))
-            unblocked.notify_all();
+        Shard &s = shard(std::hash<Key>()(k));
+        std::unique_lock<std::mutex> locker(s.mutex);
+        auto it = s.lookup.find(k);
+        if(it != s.lookup.end())
+            remove(s, it->second);
+        if(s.blocked_keys.erase(k))
+            s.unblocked.notify_all();
+    }
+
+    /* Largest cost of an element that can be kept in the main cache. */
+    std::size_t maxCost() const {
+        return main_capacity;
     }
 
 public:
     /* Set expiration time to 0 to disable expiration.
-     * Capacity limit can be exceeded if the cache contains only non-removable objects.*/
+     * Capacity is the memory budget in bytes, it is evenly distributed among shards. The capacity limit can be exceeded
+     * if the cache contains non-removable objects. */
     explicit LRUcache(std::uint64_t expiration_milliseconds,
-                      std::uint32_t capacity,
-                      std::function<const Key(const Data&)> getKey,
-                      std::function<bool (const Data&)> dirty):
-         cache(), lookup(), expiration_time(expiration_milliseconds), capacity(capacity), getKey(getKey), dirty(dirty) {};
+                      std::uint64_t capacity_bytes,
+                      std::function<std::size_t(const Data&)> cost,
+                      std::function<bool (const Data&)> dirty,
+                      std::uint32_t num_shards = 16):
+         shards(), expiration_time(expiration_milliseconds), window_capacity(0), main_capacity(0), cost(cost), dirty(dirty)
+    {
+        std::size_t shard_capacity = capacity_bytes / num_shards;
+        window_capacity = shard_capacity / 20;
+        main_capacity   = shard_capacity - window_capacity;
+        for(std::uint32_t i = 0; i < num_shards; i++)
+            shards.push_back(std::unique_ptr<Shard>(new Shard()));
+    };
     ~LRUcache(){};
 };
 
@@ -27,10 +27,22 @@
 
 static struct fuse_operations hflat_ops;
 static std::string filename;
+static thread_local struct fuse_context *request_context = nullptr;
+
+struct fuse_context *hflat_get_context(void)
+{
+    if (request_context)
+        return request_context;
+    return fuse_get_context();
+}
+
+void hflat_set_context(struct fuse_context *context)
+{
+    request_context = context;
+}
 
 static bool parse_configuration(
-        std::vector< hflat::Partition > &clustermap, hflat::Partition &logpartition,
-        int &cache_expiration_ms, int &direntry_clustersize, PosixMode &pmode)
+        std::vector< hflat::Partition > &clustermap, hflat::Partition &logpartition, hflat_options &opt)
 {
     auto cfg_to_hflat = [&](config_setting_t *partition, hflat::Partition &p) -> bool {
         if(partition)
@@ -83,13 +95,34 @@ static bool parse_configuration(
 
 
     if (config_setting_t * options =  config_lookup(&cfg, "options")){
-        config_setting_lookup_int(options, "cache_expiration", &cache_expiration_ms);
-        config_setting_lookup_int(options, "direntry_clustersize", &direntry_clustersize);
+        config_setting_lookup_int(options, "cache_expiration", &opt.cache_expiration_ms);
+        config_setting_lookup_int(options, "direntry_clustersize", &opt.direntry_clustersize);
+        config_setting_lookup_int(options, "write_lease_duration", &opt.write_lease_duration_ms);
+        config_setting_lookup_int(options, "pathmap_refresh_interval", &opt.pathmap_refresh_ms);
+        config_setting_lookup_int(options, "pathmap_fetch_window", &opt.pathmap_fetch_window);
+        config_setting_lookup_int(options, "pathmap_checkpoint_interval", &opt.pathmap_checkpoint_interval);
+        config_setting_lookup_int(options, "permission_verify_rate", &opt.permission_verify_rate);
+
+        int flag;
+        if( config_setting_lookup_bool(options, "readdir_attributes", &flag) )
+            opt.readdir_attributes = flag;
+
+        int megabytes;
+        if( config_setting_lookup_int(options, "metadata_cache_size", &megabytes) )
+            opt.metadata_cache_bytes = (std::uint64_t) megabytes * 1024 * 1024;
+        if( config_setting_lookup_int(options, "data_cache_size", &megabytes) )
+            opt.data_cache_bytes = (std::uint64_t) megabytes * 1024 * 1024;
+        if( config_setting_lookup_int(options, "listing_cache_size", &megabytes) )
+            opt.listing_cache_bytes = (std::uint64_t) megabytes * 1024 * 1024;
 
         const char *mode;
         if( config_setting_lookup_string(options, "posix_mode", &mode) )
             if(strcmp(mode,"RELAXED") == 0)
-                pmode = PosixMode::TIMERELAXED;
+                opt.posix = PosixMode::TIMERELAXED;
+
+        const char *file;
+        if( config_setting_lookup_string(options, "pathmap_cache_file", &file) )
+            opt.pathmap_cache_file = file;
     }
 
 
@@ -117,35 +150,35 @@ void *hflat_init(struct fuse_conn_info *conn)
     struct hflat_priv *priv = 0;
     std::vector< hflat::Partition > clustermap;
     hflat::Partition logpartition;
-    PosixMode mode = PosixMode::FULL;
-    int cache_expiration_ms = 1000;
-    int direntry_clustersize = 1;
+    hflat_options opt;
 
     if(! filename.empty()){
-        bool cok = parse_configuration(
-                        clustermap, logpartition,
-                        cache_expiration_ms, direntry_clustersize,
-                        mode);
+        bool cok = parse_configuration(clustermap, logpartition, opt);
         REQ_TRUE(cok);
     }
 
     try {
         if(clustermap.empty())
-            priv = new hflat_priv(new SimpleKineticNamespace(), cache_expiration_ms, 1024*1024, mode);
+            priv = new hflat_priv(new SimpleKineticNamespace(), 1024*1024, opt);
         else if(clustermap.size() == 1 && clustermap.at(0).drives_size() == 1)
-            priv = new hflat_priv(new SimpleKineticNamespace(clustermap[0].drives(0)), cache_expiration_ms, 1024*1024, mode);
+            priv = new hflat_priv(new SimpleKineticNamespace(clustermap[0].drives(0)), 1024*1024, opt);
         else
-            priv = new hflat_priv(new DistributedKineticNamespace(clustermap, logpartition, direntry_clustersize), cache_expiration_ms, 1024*1024, mode);
+            priv = new hflat_priv(new DistributedKineticNamespace(clustermap, logpartition, opt.direntry_clustersize), 1024*1024, opt);
     }
     catch(std::exception& e){
         hflat_error("Exception thrown during mount operation. Reason: %s \n Check your Configuration.",e.what());
         REQ_TRUE(false);
     }
-    fuse_get_context()->private_data = priv;
+    hflat_get_context()->private_data = priv;
+
+    /* Identify this client in write leases and key versions. */
+    std::string client_id = util::generate_uuid();
+    PRIV->leases.setClientId(client_id);
+    PRIV->version_prefix = client_id.substr(0, 8);
 
 
     /* Setup values required for inode generation. */
-    if ( util::grab_inode_generation_token() )
+    if ( PRIV->inodes.start(PRIV, util::claim_inode_numbers) )
         hflat_error("Error encountered during setup of inode number generation");
 
     /* Verify that root metadata is available. If it isn't, initialize it. */
@@ -158,7 +191,11 @@ void *hflat_init(struct fuse_conn_info *conn)
     if (err)
         hflat_error("Error encountered validating root metadata");
 
+    PRIV->workers.start(PRIV, 16);
+    util::database_load_cache();
     util::database_update();
+    util::database_refresh_start();
+    PRIV->permission_verifier.start(PRIV);
     return PRIV;
 }
 
@@ -171,8 +208,9 @@ void *hflat_init(struct fuse_conn_info *conn)
  */
 void hflat_destroy(void *priv)
 {
-    google::protobuf::ShutdownProtobufLibrary();
+    util::database_store_cache();
     delete PRIV;
+    google::protobuf::ShutdownProtobufLibrary();
 }
 
 
@@ -187,8 +225,8 @@ static void init_hflat_ops(fuse_operations *ops)
 
     ops->mkdir = hflat_mkdir;
     ops->rmdir = hflat_rmdir;
-    ops->opendir = hflat_open;
-    ops->releasedir = hflat_release;
+    ops->opendir = hflat_opendir;
+    ops->releasedir = hflat_releasedir;
     ops->readdir = hflat_readdir;
 
     ops->access = hflat_access;
@@ -239,13 +277,23 @@ int main(int argc, char *argv[])
 
     init_hflat_ops(&hflat_ops);
 
-    /* extract cfg file path */
+    /* extract cfg file path and frontend selection */
+    bool lowlevel = false;
     for(int i=0; i<argc; i++){
+        bool consumed = false;
         if(strncmp(argv[i],"-cfg=",5) == 0){
             filename = std::string(argv[i]+5);
+            consumed = true;
+        }
+        else if(strcmp(argv[i],"-lowlevel") == 0){
+            lowlevel = true;
+            consumed = true;
+        }
+        if(consumed){
             for(int j=i+1; j<argc; j++)
                 argv[j-1] = argv[j];
             argc--;
+            i--;
         }
     }
 
@@ -259,5 +307,7 @@ int main(int argc, char *argv[])
         hflat_trace("using configuration file %s",filename.c_str());
     }
 
+    if(lowlevel)
+        return hflat_lowlevel_main(argc, argv);
     return fuse_main(argc, argv, &hflat_ops, nullptr);
 }
@@ -22,63 +22,204 @@
 #include <unistd.h>
 #include <memory>
 #include <functional>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <map>
+#include <vector>
 
 #include "pathmap_db.h"
 #include "metadata_info.h"
 #include "kinetic_namespace.h"
 #include "lru_cache.h"
+#include "write_lease.h"
+#include "open_files.h"
+#include "pathmap_refresher.h"
+#include "inode_allocator.h"
+#include "permission_verifier.h"
+#include "worker_pool.h"
 
 enum class PosixMode { FULL, TIMERELAXED };
+
+/* Metadata key version and mtime of a file as observed at release. Used to decide if the kernel
+ * page cache may be kept when the file is opened again. */
+struct PageCacheInfo
+{
+    std::string     key;
+    std::string     keyVersion;
+    std::uint32_t   mtime;
+};
+
+/* Entries of a directory and the directory metadata key version they have been listed at.
+ * Compare hflat_readdir(). */
+struct DirectoryListing
+{
+    /* Stored in the directory entry key, inode number and type are 0 if unknown. */
+    struct Entry
+    {
+        std::uint64_t   inode_number;
+        mode_t          type;
+    };
+
+    std::mutex              lock;
+    std::string             keyVersion;
+    std::map<std::string, Entry> entries;  // name -> entry
+    std::atomic<std::size_t> bytes;     // approximate memory usage of entries
+
+    DirectoryListing() : lock(), keyVersion(), entries(), bytes(0) {}
+};
+
+/* Per handle state of an open directory, stored in fuse_file_info::fh. Entries are read page by page, the offset
+ * of an entry is its position in the listing. Compare hflat_readdir(). */
+struct OpenDirectory
+{
+    std::mutex                  lock;
+    std::uint64_t               inode_number;
+    std::int64_t                base;       // position of the first entry of page
+    std::vector<std::pair<std::string, DirectoryListing::Entry>> page;
+    std::uint32_t               page_size;  // of the next page read
+    bool                        complete;   // page is the last page
+    std::shared_ptr<DirectoryListing> cached;   // pages are read from this cached listing if set
+    std::shared_ptr<DirectoryListing> listing;  // built from the pages read until it is complete or too large
+
+    OpenDirectory() :
+        lock(), inode_number(0), base(0), page(), page_size(0), complete(false), cached(), listing() {}
+};
+
+/* Client configuration, compare example.cfg */
+struct hflat_options
+{
+    int             cache_expiration_ms;
+    int             direntry_clustersize;
+    PosixMode       posix;
+    int             write_lease_duration_ms;
+    std::uint64_t   metadata_cache_bytes;
+    std::uint64_t   data_cache_bytes;
+    std::uint64_t   listing_cache_bytes;
+    int             pathmap_refresh_ms;
+    int             pathmap_fetch_window;
+    int             pathmap_checkpoint_interval;
+    std::string     pathmap_cache_file;
+    int             permission_verify_rate;
+    bool            readdir_attributes;
+
+    hflat_options():
+        cache_expiration_ms(1000),
+        direntry_clustersize(1),
+        posix(PosixMode::FULL),
+        write_lease_duration_ms(0),
+        metadata_cache_bytes(4*1024*1024),
+        data_cache_bytes(500*1024*1024),
+        listing_cache_bytes(16*1024*1024),
+        pathmap_refresh_ms(0),
+        pathmap_fetch_window(16),
+        pathmap_checkpoint_interval(42),
+        pathmap_cache_file(),
+        permission_verify_rate(0),
+        readdir_attributes(false)
+    {}
+};
+
 /* Private file-system wide data, accessible from anywhere. */
 struct hflat_priv
 {
     std::unique_ptr<KineticNamespace> kinetic;
     LRUcache<std::string, std::shared_ptr<MetadataInfo>> lookup_cache;
     LRUcache<std::string, std::shared_ptr<DataInfo>>     data_cache;
+    LRUcache<std::string, std::shared_ptr<PageCacheInfo>> pagecache_info;
+    LRUcache<std::string, std::shared_ptr<DirectoryListing>> listing_cache;    // directory inode number -> listing
     PathMapDB pmap;
+    WriteLeases leases;
+    OpenFiles open_files;
 
     /* superblock like information */
     std::int32_t    blocksize;
     PosixMode       posix;
+    hflat_options   options;    // configuration supplied at mount time
+
+    /* Set by the low-level frontend: invalidate kernel dentries of a user path that has been changed by
+     * another client, compare database_update() */
+    std::function<void(const std::string &user_path)> invalidate_entry;
 
     /* inode generation */
-    std::int64_t    inum_base;
-    std::uint16_t   inum_counter;
-    std::mutex      lock;
+    InodeAllocator  inodes;
+
+    /* key version generation, compare util::generate_version() */
+    std::string                 version_prefix;
+    std::atomic<std::uint64_t>  version_counter;
 
-    hflat_priv(KineticNamespace *kn, int cache_expiration_ms, int block_size_bytes, PosixMode mode):
+    /* path map checkpointing: latest known checkpoint version (-1 if unknown), a checkpoint is written by a worker */
+    std::atomic<std::int64_t> checkpoint_version;
+    std::atomic<bool>         checkpoint_running;
+
+    /* Declared last: the background refresher, verifier and workers use the members above until they are stopped. */
+    PathMapRefresher pmap_refresher;
+    PermissionVerifier permission_verifier;
+    WorkerPool workers;     // read-ahead, directory entry and path map requests, checkpoints
+
+    hflat_priv(KineticNamespace *kn, int block_size_bytes, const hflat_options &opt):
             kinetic(kn),
-            lookup_cache(cache_expiration_ms, 1000,
-                    std::mem_fn(&MetadataInfo::getSystemPath),
+            lookup_cache(opt.cache_expiration_ms, opt.metadata_cache_bytes,
+                    std::mem_fn(&MetadataInfo::memoryUsage),
                     [](const std::shared_ptr<MetadataInfo> &mdi){
                        auto di = mdi->getDirtyData();
                        if (!di) return false;
                        return di->hasUpdates();
             }),
-            data_cache(cache_expiration_ms, 500,
-                    std::mem_fn(&DataInfo::getKey),
+            data_cache(opt.cache_expiration_ms, opt.data_cache_bytes,
+                    std::mem_fn(&DataInfo::memoryUsage),
                     std::mem_fn(&DataInfo::hasUpdates)
             ),
+            pagecache_info(0, 1024*1024,
+                    [](const std::shared_ptr<PageCacheInfo> &pci){ return sizeof(PageCacheInfo) + pci->key.size() + pci->keyVersion.size(); },
+                    [](const std::shared_ptr<PageCacheInfo> &pci){ return false; }
+            ),
+            /* With POSIX time stamps every entry change updates the directory metadata key, listings are verified
+             * against its version. Otherwise they expire like other cached items. Listings are large compared to other
+             * cached items, few shards leave room for the listings of large directories. */
+            listing_cache(opt.posix == PosixMode::FULL ? 0 : opt.cache_expiration_ms, opt.listing_cache_bytes,
+                    [](const std::shared_ptr<DirectoryListing> &dl){ return sizeof(DirectoryListing) + dl->bytes; },
+                    [](const std::shared_ptr<DirectoryListing> &dl){ return false; },
+                    4
+            ),
             pmap(),
+            leases(opt.write_lease_duration_ms),
+            open_files(),
             blocksize(block_size_bytes),
-            posix(mode),   // POSIX conform updating of directory time stamps costs performance
-            inum_base(0),
-            inum_counter(0),
-            lock()
+            posix(opt.posix),   // POSIX conform updating of directory time stamps costs performance
+            options(opt),
+            invalidate_entry(),
+            inodes(),
+            version_prefix(),
+            version_counter(0),
+            checkpoint_version(-1),
+            checkpoint_running(false),
+            pmap_refresher(opt.pathmap_refresh_ms),
+            permission_verifier(opt.permission_verify_rate),
+            workers()
     {}
 };
-#define PRIV ((struct hflat_priv*) fuse_get_context()->private_data)
+
+/* Context of the current request. Provided by the fuse library for the high-level path based frontend, the
+ * low-level frontend sets the context for each request it handles. */
+struct fuse_context *hflat_get_context(void);
+void hflat_set_context(struct fuse_context *context);
+#define PRIV ((struct hflat_priv*) hflat_get_context()->private_data)
 
 
 /* these are utility functions provided to the various fuse operations */
 
+/* attr */
+void metadata_to_stat(const std::shared_ptr<MetadataInfo> &mdi, struct stat *attr);
+
 /* lookup */
 int lookup(const char *user_path, std::shared_ptr<MetadataInfo> &mdi);
 int lookup_parent(const char *user_path, std::shared_ptr<MetadataInfo> &mdi_parent);
 int get_metadata_userpath(const char *user_path, std::shared_ptr<MetadataInfo> &mdi);
+int lookup_open_file(const char *user_path, struct fuse_file_info *fi, std::shared_ptr<MetadataInfo> &mdi);
 
 /* directory */
-int create_directory_entry(const std::shared_ptr<MetadataInfo> &mdi_parent, std::string filename);
+int create_directory_entry(const std::shared_ptr<MetadataInfo> &mdi_parent, std::string filename, const std::shared_ptr<MetadataInfo> &mdi);
 int delete_directory_entry(const std::shared_ptr<MetadataInfo> &mdi_parent, std::string filename);
 
 /* permission */
@@ -90,13 +231,18 @@ void inherit_path_permissions(const std::shared_ptr<MetadataInfo> &mdi, const st
 
 namespace util
 {
-    int grab_inode_generation_token(void);
+    int claim_inode_numbers(std::uint64_t count, std::uint64_t &base);
     ino_t generate_inode_number(void);
     std::string generate_uuid(void);
+    std::string generate_version(void);
+    KineticRecord serialized_record(const google::protobuf::Message &msg, const std::string &version);
     std::int64_t to_int64(const std::string &version_string);
     std::int64_t to_int64(const std::shared_ptr<const std::string> version_string);
     std::string path_to_filename(const std::string &path);
     int database_update(void);
+    void database_refresh_start(void);
+    void database_load_cache(void);
+    void database_store_cache(void);
     int database_operation(hflat::db_entry &entry);
 }
 
@@ -18,9 +18,10 @@
 #include <chrono>
 #include <sys/stat.h>
 #include <errno.h>
+#include <algorithm>
 
 MetadataInfo::MetadataInfo(const std::string &key) :
-        systemPath(key), keyVersion("0")
+        systemPath(key), keyVersion("0"), flush_active(false), flush_size(0), flush_requested(0), flush_completed(0)
 {
 }
 
@@ -48,6 +49,11 @@ void MetadataInfo::setKeyVersion(const std::string &vc)
     keyVersion=vc;
 }
 
+std::size_t MetadataInfo::memoryUsage() const
+{
+    return sizeof(MetadataInfo) + systemPath.size() + keyVersion.size() + md.SpaceUsed();
+}
+
 void MetadataInfo::updateACMtime()
 {
     std::time_t now;
@@ -77,10 +83,66 @@ std::shared_ptr<DataInfo>& MetadataInfo::getDirtyData()
     return dirty_data;
 }
 
+int MetadataInfo::batchFlush(std::uint64_t size, std::function<int(std::uint64_t)> flush)
+{
+    std::unique_lock<std::mutex> locker(flush_lock);
+    flush_size = std::max(flush_size, size);
+    std::uint64_t ticket = ++flush_requested;
+
+    while (flush_completed < ticket) {
+        if (flush_active) {
+            flush_done.wait(locker);
+            continue;
+        }
+        /* Become the flusher for every request that has arrived so far. */
+        flush_active = true;
+        std::uint64_t batch_end  = flush_requested;
+        std::uint64_t batch_size = flush_size;
+        flush_size = 0;
+
+        locker.unlock();
+        int err = flush(batch_size);
+        locker.lock();
+
+        /* Every ticket after the previously completed batch is covered by this batch. */
+        flush_results[batch_end] = FlushBatch{err, batch_end - flush_completed};
+        flush_active    = false;
+        flush_completed = batch_end;
+        flush_done.notify_all();
+    }
+
+    /* Return the result of the batch covering this ticket, a later batch may already have completed. */
+    auto batch = flush_results.lower_bound(ticket);
+    int err = batch->second.result;
+    if (--batch->second.waiting == 0)
+        flush_results.erase(batch);
+    return err;
+}
+
 void MetadataInfo::setMD(const hflat::Metadata & md, const std::string &vc)
 {
     this->md = md;
     this->keyVersion = vc;
+
+    std::lock_guard<std::mutex> locker(permission_lock);
+    permission_compiled.reset();
+    permission_children_compiled.reset();
+}
+
+bool MetadataInfo::parseMD(const std::string &value, const std::string &vc)
+{
+    /* The metadata might be in use, a failed parse must not clear it. Parsing into a per-thread message that is swapped
+     * in on success reuses the fields allocated by previous parses. */
+    thread_local hflat::Metadata scratch;
+    if (!scratch.ParseFromString(value))
+        return false;
+    md.Swap(&scratch);
+    this->keyVersion = vc;
+
+    std::lock_guard<std::mutex> locker(permission_lock);
+    permission_compiled.reset();
+    permission_children_compiled.reset();
+    return true;
 }
 
 hflat::Metadata & MetadataInfo::getMD()
@@ -88,6 +150,63 @@ hflat::Metadata & MetadataInfo::getMD()
     return md;
 }
 
+static bool equal(const hflat::Metadata_ReachabilityEntry &lhs, const hflat::Metadata_ReachabilityEntry &rhs)
+{
+    if(lhs.uid() != rhs.uid())      return false;
+    if(lhs.gid() != rhs.gid())      return false;
+    if(lhs.type() != rhs.type())    return false;
+    return true;
+}
+
+std::shared_ptr<const PathPermission> MetadataInfo::compiled(std::shared_ptr<const PathPermission> &c,
+        const google::protobuf::RepeatedPtrField<hflat::Metadata_ReachabilityEntry> &entries)
+{
+    std::lock_guard<std::mutex> locker(permission_lock);
+    if (!c)
+        c = std::make_shared<PathPermission>(entries);
+    return c;
+}
+
+int MetadataInfo::checkPathPermissions(std::uint32_t uid, std::uint32_t gid)
+{
+    return compiled(permission_compiled, md.path_permission())->check(uid, gid);
+}
+
+int MetadataInfo::checkPathPermissionChildren(std::uint32_t uid, std::uint32_t gid)
+{
+    return compiled(permission_children_compiled, md.path_permission_children())->check(uid, gid);
+}
+
+void MetadataInfo::inheritPathPermissions(MetadataInfo &parent)
+{
+    const hflat::Metadata &pmd = parent.getMD();
+    const int size = pmd.path_permission_size() + pmd.path_permission_children_size();
+
+    /* Path permissions existing for directory, followed by path permissions precomputed for directory's children. */
+    auto inherited = [&pmd](int i) -> const hflat::Metadata_ReachabilityEntry & {
+        if (i < pmd.path_permission_size())
+            return pmd.path_permission(i);
+        return pmd.path_permission_children(i - pmd.path_permission_size());
+    };
+
+    bool changed = md.path_permission_size() != size;
+    for (int i = 0; i < size && !changed; i++)
+        changed = !equal(md.path_permission(i), inherited(i));
+
+    /* Cleared entries stay allocated in the repeated field and are reused by add_path_permission() */
+    if (changed) {
+        md.mutable_path_permission()->Clear();
+        for (int i = 0; i < size; i++)
+            *md.add_path_permission() = inherited(i);
+
+        std::lock_guard<std::mutex> locker(permission_lock);
+        permission_compiled.reset();
+    }
+    md.set_path_permission_verified(pmd.path_permission_verified());
+
+    if (S_ISDIR(md.mode())) computePathPermissionChildren();
+}
+
 bool MetadataInfo::computePathPermissionChildren()
 {
     /* Execute permission for user / group / other */
@@ -125,12 +244,6 @@ bool MetadataInfo::computePathPermissionChildren()
             addEntry(hflat::Metadata_ReachabilityType_GID_REQ_UID);
     }
 
-    auto equal = [](const hflat::Metadata_ReachabilityEntry &lhs, const hflat::Metadata_ReachabilityEntry &rhs) -> bool {
-        if(lhs.uid() != rhs.uid())      return false;
-        if(lhs.gid() != rhs.gid())      return false;
-        if(lhs.type() != rhs.type())    return false;
-        return true;
-    };
     /* Remove all entries that are duplicates of entries stored in pathPermission.
      * If a restriction is already enforced by a parent directory, there's no need to enforce it again. */
     for (int i = 0; i < md.path_permission_size(); i++)
@@ -139,7 +252,7 @@ bool MetadataInfo::computePathPermissionChildren()
                 v.erase(it);
 
 
-    auto ppc_contains = [this, equal](const hflat::Metadata_ReachabilityEntry &e) -> bool {
+    auto ppc_contains = [this](const hflat::Metadata_ReachabilityEntry &e) -> bool {
         for (int i = 0; i < md.path_permission_children_size(); i++)
             if (equal(md.path_permission_children(i), e))
                 return true;
@@ -157,6 +270,8 @@ bool MetadataInfo::computePathPermissionChildren()
             hflat::Metadata_ReachabilityEntry *entry = md.mutable_path_permission_children()->Add();
             entry->CopyFrom(*it);
         }
+        std::lock_guard<std::mutex> locker(permission_lock);
+        permission_children_compiled.reset();
     }
     return changed;
 }
@@ -18,8 +18,12 @@
 #define METADATA_INFO_H_
 #include "metadata.pb.h"
 #include "data_info.h"
+#include "path_permission.h"
 #include <memory>
 #include <map>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 class MetadataInfo final
 {
@@ -31,17 +35,38 @@ private:
     // write aggregation support
     std::shared_ptr<DataInfo> dirty_data; // reference to data block updated by a write call compare data.cc
 
+    // flush batching support, compare batchFlush()
+    std::mutex                flush_lock;
+    std::condition_variable   flush_done;
+    bool                      flush_active;
+    std::uint64_t             flush_size;      // maximum size requested by flushes waiting for the next batch
+    std::uint64_t             flush_requested; // number of flushes requested
+    std::uint64_t             flush_completed; // number of flushes covered by a completed batch
+    struct FlushBatch { int result; std::uint64_t waiting; };
+    std::map<std::uint64_t, FlushBatch> flush_results;  // completed batches by last ticket, until all waiters returned
+
+    // compiled path permissions, built on first use after a change compare checkPathPermissions()
+    std::mutex                            permission_lock;
+    std::shared_ptr<const PathPermission> permission_compiled;
+    std::shared_ptr<const PathPermission> permission_children_compiled;
+
+private:
+    std::shared_ptr<const PathPermission> compiled(std::shared_ptr<const PathPermission> &c,
+            const google::protobuf::RepeatedPtrField<hflat::Metadata_ReachabilityEntry> &entries);
+
 public:
     explicit MetadataInfo(const std::string &key);
     ~MetadataInfo();
 
 public:
     void                setMD(const hflat::Metadata& md, const std::string& version);
+    bool                parseMD(const std::string& value, const std::string& version);  // unchanged and false if invalid
     hflat::Metadata & getMD();
     void                setSystemPath(const std::string &key);
     const std::string & getSystemPath() const;
     void                setKeyVersion(const std::string &version);
     const std::string & getKeyVersion() const;
+    std::size_t         memoryUsage() const;
 
 
     // convenience functions to update time-stamps according to current local clock
@@ -51,8 +76,21 @@ public:
     // returns 'true' if changed, 'false' if unchanged
     bool computePathPermissionChildren();
 
+    // Inherit path permissions of the parent directory. Path permissions may only be modified using these functions
+    // or setMD(), otherwise the compiled path permissions will not be updated.
+    void inheritPathPermissions(MetadataInfo &parent);
+
+    // Check if the supplied user passes path permissions of this inode or, for directories, of its children.
+    // Returns 0 or -EACCES.
+    int checkPathPermissions(std::uint32_t uid, std::uint32_t gid);
+    int checkPathPermissionChildren(std::uint32_t uid, std::uint32_t gid);
+
     bool setDirtyData(std::shared_ptr<DataInfo>& di);
     std::shared_ptr<DataInfo>& getDirtyData();
+
+    // Concurrent flushes are combined: only one call of the supplied flush function is in progress at any time,
+    // it is called with the maximum size requested by all flushes that arrived while the previous call was in progress.
+    int batchFlush(std::uint64_t size, std::function<int(std::uint64_t)> flush);
 };
 
 #endif /* METADATA_INFO_H_ */
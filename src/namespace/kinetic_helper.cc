@@ -17,6 +17,9 @@
 #include "kinetic_namespace.h"
 #include "main.h"
 #include "debug.h"
+#include <random>
+#include <algorithm>
+#include <thread>
 
 using namespace util;
 using kinetic::StatusCode;
@@ -24,6 +27,8 @@ using com::seagate::kinetic::client::proto::Command_Algorithm_SHA1;
 
 static const string db_base_name = "pathmapDB_";
 static const string db_version_key = db_base_name + "version";
+static const string db_checkpoint_key = db_base_name + "CHECKPOINT";
+static const int max_backoff_exponent = 7; // put_data backs off at most 2^7 ms between attempts
 
 int get_metadata(const std::shared_ptr<MetadataInfo> &mdi)
 {
@@ -37,18 +42,18 @@ int get_metadata(const std::shared_ptr<MetadataInfo> &mdi)
         return -EIO;
     }
 
-    hflat::Metadata md;
-    if(! md.ParseFromString( *record->value()) )
+    if(! mdi->parseMD(*record->value(), *record->version()) ){
+        PRIV->lookup_cache.invalidate(mdi->getSystemPath());
         return -EINVAL;
-    mdi->setMD(md, *record->version() );
+    }
     return 0;
 }
 
 int put_metadata(const std::shared_ptr<MetadataInfo> &mdi)
 {
-    std::string new_version  = util::generate_uuid();
+    std::string new_version  = util::generate_version();
 
-    KineticRecord record(mdi->getMD().SerializeAsString(), new_version, "", Command_Algorithm_SHA1);
+    KineticRecord record = serialized_record(mdi->getMD(), new_version);
     KineticStatus status = PRIV->kinetic->Put(mdi->getSystemPath(), mdi->getKeyVersion(), WriteMode::REQUIRE_SAME_VERSION, record);
 
     if(!status.ok()){
@@ -60,6 +65,7 @@ int put_metadata(const std::shared_ptr<MetadataInfo> &mdi)
     }
     mdi->setKeyVersion(new_version);
     PRIV->lookup_cache.revalidate(mdi->getSystemPath());
+    PRIV->lookup_cache.updateCost(mdi->getSystemPath());
     return 0;
 }
 
@@ -79,9 +85,9 @@ int put_metadata_forced(const std::shared_ptr<MetadataInfo> &mdi, std::function<
 
 int create_metadata(const std::shared_ptr<MetadataInfo> &mdi)
 {
-    std::string new_version = util::generate_uuid();
+    std::string new_version = util::generate_version();
 
-    KineticRecord record(mdi->getMD().SerializeAsString(),  new_version, "", Command_Algorithm_SHA1);
+    KineticRecord record = serialized_record(mdi->getMD(), new_version);
     KineticStatus status = PRIV->kinetic->Put(mdi->getSystemPath(), "", WriteMode::REQUIRE_SAME_VERSION, record);
 
     if (status.statusCode() ==  StatusCode::REMOTE_VERSION_MISMATCH)
@@ -110,6 +116,43 @@ int delete_metadata(const std::shared_ptr<MetadataInfo> &mdi)
     return 0;
 }
 
+int get_version(const std::string &key, std::string &version)
+{
+    unique_ptr<string> keyVersion;
+    KineticStatus status = PRIV->kinetic->GetVersion(key, keyVersion);
+
+    if (status.statusCode() ==  StatusCode::REMOTE_NOT_FOUND)
+        return -ENOENT;
+    if (!status.ok()){
+        hflat_warning("status == %s",status.message().c_str());
+        return -EIO;
+    }
+    version = *keyVersion;
+    return 0;
+}
+
+bool metadata_unchanged(const std::shared_ptr<MetadataInfo> &mdi)
+{
+    std::string version;
+    int err = get_version(mdi->getSystemPath(), version);
+
+    /* cached non-existence */
+    if (mdi->getMD().inode_number() == 0)
+        return err == -ENOENT;
+    return !err && version == mdi->getKeyVersion();
+}
+
+bool data_unchanged(const std::shared_ptr<DataInfo> &di)
+{
+    std::string version;
+    int err = get_version(di->getKey(), version);
+
+    /* data block didn't exist when read in */
+    if (di->getKeyVersion().empty())
+        return err == -ENOENT;
+    return !err && version == di->getKeyVersion();
+}
+
 int get_data(const std::string &key, std::shared_ptr<DataInfo> &di)
 {
     unique_ptr<KineticRecord> record;
@@ -130,31 +173,40 @@ int get_data(const std::string &key, std::shared_ptr<DataInfo> &di)
 
 int put_data(const std::shared_ptr<DataInfo> &di)
 {
-    std::string new_version = util::generate_uuid();
+    thread_local std::default_random_engine random_generator(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    KineticStatus status(StatusCode::OK, "");
 
-    KineticRecord record(di->data(), new_version, "", Command_Algorithm_SHA1);
-    KineticStatus status = PRIV->kinetic->Put(di->getKey(), di->getKeyVersion(), WriteMode::REQUIRE_SAME_VERSION, record);
+    for(int attempt = 0; ; attempt = std::min(attempt + 1, max_backoff_exponent)){
+        std::string new_version = util::generate_version();
 
-    /* If someone else has updated the data block since we read it in, just write the incremental changes */
-    if (status.statusCode() ==  StatusCode::REMOTE_VERSION_MISMATCH) {
-        unique_ptr<KineticRecord> record;
-        status = PRIV->kinetic->Get(di->getKey(), record);
+        KineticRecord record(di->data(), new_version, "", Command_Algorithm_SHA1);
+        status = PRIV->kinetic->Put(di->getKey(), di->getKeyVersion(), WriteMode::REQUIRE_SAME_VERSION, record);
 
-        if (status.ok()) {
-            di->mergeDataChanges(*record->value());
-            di->setKeyVersion(*record->version());
-            return put_data(di);
+        if (status.ok()){
+            di->forgetUpdates();
+            di->setKeyVersion(new_version);
+            PRIV->data_cache.revalidate(di->getKey());
+            PRIV->data_cache.updateCost(di->getKey());
+            return 0;
         }
-    }
-    if (!status.ok()){
-        hflat_warning("status == %s",status.message().c_str());
-        return -EIO;
+        if (status.statusCode() !=  StatusCode::REMOTE_VERSION_MISMATCH)
+            break;
+
+        /* If someone else has updated the data block since we read it in, just write the incremental changes.
+         * Back off randomly so that concurrent writers of the same block don't keep colliding. A version mismatch is
+         * always resolved this way, so keep retrying for as long as the drive reports nothing else. */
+        unique_ptr<KineticRecord> remote;
+        status = PRIV->kinetic->Get(di->getKey(), remote);
+        if (!status.ok())
+            break;
+        di->mergeDataChanges(*remote->value());
+        di->setKeyVersion(*remote->version());
+        std::uniform_int_distribution<int> backoff(0, (1 << attempt) - 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(backoff(random_generator)));
     }
 
-    di->forgetUpdates();
-    di->setKeyVersion(new_version);
-    PRIV->data_cache.revalidate(di->getKey());
-    return 0;
+    hflat_warning("status == %s",status.message().c_str());
+    return -EIO;
 }
 
 int delete_data(const std::shared_ptr<DataInfo> &di)
@@ -171,7 +223,7 @@ int delete_data(const std::shared_ptr<DataInfo> &di)
 int put_db_entry(std::int64_t version, const hflat::db_entry &entry)
 {
     string key = db_base_name + std::to_string(version);
-    KineticRecord record(entry.SerializeAsString(), std::to_string(version), "", Command_Algorithm_SHA1);
+    KineticRecord record = serialized_record(entry, std::to_string(version));
     KineticStatus status = PRIV->kinetic->Put(key, "", WriteMode::REQUIRE_SAME_VERSION, record);
 
     if (status.statusCode() ==  StatusCode::REMOTE_VERSION_MISMATCH)
@@ -224,31 +276,71 @@ int get_db_version(std::int64_t &version)
 }
 
 
-int put_db_snapshot (const hflat::db_snapshot &s)
+static string db_checkpoint_chunk_key(std::int64_t version, int index)
+{
+    return db_checkpoint_key + "_" + std::to_string(version) + "_" + std::to_string(index);
+}
+
+int put_db_checkpoint(const hflat::db_checkpoint &c, std::int64_t previous_version)
 {
-    string key = db_base_name + "SNAPSHOT";
-    KineticRecord record(s.SerializeAsString(), "", "", Command_Algorithm_SHA1);
-    KineticStatus status = PRIV->kinetic->Put(key, "", WriteMode::IGNORE_VERSION, record);
+    KineticRecord record = serialized_record(c, std::to_string(c.snapshot_version()));
+    KineticStatus status = PRIV->kinetic->Put(db_checkpoint_key, previous_version ? std::to_string(previous_version) : "",
+            WriteMode::REQUIRE_SAME_VERSION, record);
 
+    if (status.statusCode() ==  StatusCode::REMOTE_VERSION_MISMATCH)
+        return -EAGAIN;
     if (!status.ok())
         return -EIO;
 
-    hflat_trace("Stored serialized snapshot for database version %ld",s.snapshot_version());
+    hflat_trace("Stored checkpoint for database version %ld consisting of %d chunks",c.snapshot_version(), c.chunks());
     return 0;
-
 }
-int get_db_snapshot (hflat::db_snapshot &s)
+
+int get_db_checkpoint(hflat::db_checkpoint &c)
 {
-    string key = db_base_name + "SNAPSHOT";
     unique_ptr<KineticRecord> record;
-    KineticStatus status = PRIV->kinetic->Get(key, record);
+    KineticStatus status = PRIV->kinetic->Get(db_checkpoint_key, record);
 
+    if (status.statusCode() ==  StatusCode::REMOTE_NOT_FOUND)
+        return -ENOENT;
     if (!status.ok())
         return -EIO;
-
-    if(!s.ParseFromString(*record->value()))
+    if(!c.ParseFromString(*record->value()))
         return -EINVAL;
+    return 0;
+}
+
+int put_db_checkpoint_chunk(std::int64_t version, int index, const hflat::db_snapshot &chunk)
+{
+    KineticRecord record = serialized_record(chunk, "");
+    KineticStatus status = PRIV->kinetic->Put(db_checkpoint_chunk_key(version, index), "", WriteMode::IGNORE_VERSION, record);
 
-    hflat_trace("Loaded serialized snapshot for database version %ld",s.snapshot_version());
+    if (!status.ok())
+        return -EIO;
     return 0;
 }
+
+int get_db_checkpoint_chunk(std::int64_t version, int index, hflat::db_snapshot &chunk)
+{
+    unique_ptr<KineticRecord> record;
+    KineticStatus status = PRIV->kinetic->Get(db_checkpoint_chunk_key(version, index), record);
+
+    if (status.statusCode() ==  StatusCode::REMOTE_NOT_FOUND)
+        return -ENOENT;
+    if (!status.ok())
+        return -EIO;
+    if(!chunk.ParseFromString(*record->value()) || chunk.snapshot_version() != version)
+        return -EINVAL;
+    return 0;
+}
+
+int delete_db_checkpoint(std::int64_t version, int chunks)
+{
+    int err = 0;
+    for (int i = 0; i < chunks; i++) {
+        KineticStatus status = PRIV->kinetic->Delete(db_checkpoint_chunk_key(version, i), "", WriteMode::IGNORE_VERSION);
+        if (!status.ok() && status.statusCode() != StatusCode::REMOTE_NOT_FOUND)
+            err = -EIO;
+    }
+    return err;
+}
@@ -30,9 +30,14 @@ int put_metadata    (const std::shared_ptr<MetadataInfo> &mdi); // version misma
 int put_metadata_forced(const std::shared_ptr<MetadataInfo> &mdi, std::function<void()> md_update);
 
 
+/* Key versions, used to verify that expired cache entries are still valid. */
+int get_version (const std::string &key, std::string &version);  // key doesn't exist -> -ENOENT
+bool metadata_unchanged(const std::shared_ptr<MetadataInfo> &mdi);
+bool data_unchanged    (const std::shared_ptr<DataInfo> &di);
+
 /* Data */
 int get_data    (const std::string &key, std::shared_ptr<DataInfo> &di);
-int put_data    (const std::shared_ptr<DataInfo> &di);          // will always resolve version miss-match using incremental update
+int put_data    (const std::shared_ptr<DataInfo> &di);          // resolves version miss-match using incremental update, -EIO on other errors
 int delete_data (const std::shared_ptr<DataInfo> &di);          // ignores version
 
 /* Database */
@@ -40,7 +45,11 @@ int put_db_entry    (std::int64_t version, const hflat::db_entry &entry);
 int get_db_entry    (std::int64_t version, hflat::db_entry &entry);
 int get_db_version  (std::int64_t &version);
 
-int put_db_snapshot (const hflat::db_snapshot &s);
-int get_db_snapshot (hflat::db_snapshot &s);
+/* Checkpoints: a manifest and the chunks it refers to. Chunks have to be stored before the manifest. */
+int put_db_checkpoint       (const hflat::db_checkpoint &c, std::int64_t previous_version); // version mismatch -> -EAGAIN
+int get_db_checkpoint       (hflat::db_checkpoint &c);                                      // no checkpoint -> -ENOENT
+int put_db_checkpoint_chunk (std::int64_t version, int index, const hflat::db_snapshot &chunk);
+int get_db_checkpoint_chunk (std::int64_t version, int index, hflat::db_snapshot &chunk);
+int delete_db_checkpoint    (std::int64_t version, int chunks);
 
 #endif
@@ -0,0 +1,96 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "open_files.h"
+
+OpenFiles::OpenFiles() :
+        inodes(), lock()
+{
+}
+
+OpenFiles::~OpenFiles()
+{
+}
+
+OpenFile *OpenFiles::open(const std::shared_ptr<MetadataInfo> &mdi)
+{
+    std::lock_guard<std::mutex> locker(lock);
+    std::uint64_t ino = mdi->getMD().inode_number();
+
+    auto it = inodes.find(ino);
+    if (it == inodes.end()) {
+        Inode i = { mdi->getSystemPath(), mdi, 0, false };
+        it = inodes.insert(std::make_pair(ino, i)).first;
+    }
+    it->second.handles++;
+    return new OpenFile(ino);
+}
+
+bool OpenFiles::release(OpenFile *file, std::shared_ptr<MetadataInfo> &mdi, bool &unlinked)
+{
+    std::unique_ptr<OpenFile> f(file);
+    std::lock_guard<std::mutex> locker(lock);
+
+    auto it = inodes.find(f->inode_number);
+    if (it == inodes.end())
+        return false;
+    mdi = it->second.mdi;
+    unlinked = it->second.unlinked;
+
+    if (--it->second.handles)
+        return false;
+    inodes.erase(it);
+    return true;
+}
+
+bool OpenFiles::get(const OpenFile &file, std::string &key, std::shared_ptr<MetadataInfo> &mdi)
+{
+    std::lock_guard<std::mutex> locker(lock);
+    auto it = inodes.find(file.inode_number);
+    if (it == inodes.end())
+        return false;
+    key = it->second.key;
+    mdi = it->second.mdi;
+    return !it->second.unlinked;
+}
+
+void OpenFiles::update(const OpenFile &file, const std::string &key, const std::shared_ptr<MetadataInfo> &mdi)
+{
+    std::lock_guard<std::mutex> locker(lock);
+    auto it = inodes.find(file.inode_number);
+    if (it == inodes.end() || it->second.unlinked)
+        return;
+    it->second.key = key;
+    it->second.mdi = mdi;
+}
+
+void OpenFiles::renamed(std::uint64_t inode_number, const std::string &from, const std::string &to)
+{
+    std::lock_guard<std::mutex> locker(lock);
+    auto it = inodes.find(inode_number);
+    if (it != inodes.end() && it->second.key == from)
+        it->second.key = to;
+}
+
+bool OpenFiles::unlinked(std::uint64_t inode_number)
+{
+    std::lock_guard<std::mutex> locker(lock);
+    auto it = inodes.find(inode_number);
+    if (it == inodes.end())
+        return false;
+    it->second.unlinked = true;
+    return true;
+}
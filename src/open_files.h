@@ -0,0 +1,81 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OPEN_FILES_H_
+#define OPEN_FILES_H_
+#include "metadata_info.h"
+#include <unordered_map>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+/* Per handle state of an open file, stored in fuse_file_info::fh. */
+struct OpenFile
+{
+    const std::uint64_t     inode_number;
+    std::mutex              lock;
+
+    /* read-ahead state */
+    std::int64_t            next_offset;      // offset following the last read
+    std::uint32_t           sequential;       // number of consecutive sequential reads
+    std::int64_t            readahead_block;  // last block prefetched
+
+    explicit OpenFile(std::uint64_t ino) :
+        inode_number(ino), lock(), next_offset(0), sequential(0), readahead_block(-1) {}
+};
+
+/* Open file table. Data operations of open files obtain metadata using the system key of the file, without
+ * resolving the user path. The system key of an open file is updated if it is renamed locally. If an open file
+ * is unlinked, it remains accessible using the last known metadata and its data is deleted after the last handle
+ * has been released. */
+class OpenFiles final
+{
+private:
+    struct Inode
+    {
+        std::string                   key;
+        std::shared_ptr<MetadataInfo> mdi;
+        std::uint32_t                 handles;
+        bool                          unlinked;
+    };
+    std::unordered_map<std::uint64_t, Inode> inodes;
+    std::mutex lock;
+
+public:
+    OpenFile *open(const std::shared_ptr<MetadataInfo> &mdi);
+
+    /* Returns true if the last handle of the inode has been released. The inode data has to be deleted if
+     * the inode was unlinked. */
+    bool release(OpenFile *file, std::shared_ptr<MetadataInfo> &mdi, bool &unlinked);
+
+    /* Obtain system key and last known metadata of an open file. Returns false if the file has been unlinked. */
+    bool get(const OpenFile &file, std::string &key, std::shared_ptr<MetadataInfo> &mdi);
+    void update(const OpenFile &file, const std::string &key, const std::shared_ptr<MetadataInfo> &mdi);
+
+    void renamed(std::uint64_t inode_number, const std::string &from, const std::string &to);
+
+    /* Returns true if the inode is open, in which case deletion of its data has to be deferred. */
+    bool unlinked(std::uint64_t inode_number);
+
+public:
+    OpenFiles();
+    ~OpenFiles();
+    OpenFiles(const OpenFiles& rhs) = delete;
+    OpenFiles& operator=(const OpenFiles& rhs) = delete;
+};
+
+#endif /* OPEN_FILES_H_ */
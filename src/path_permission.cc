@@ -0,0 +1,119 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "path_permission.h"
+#include <algorithm>
+#include <errno.h>
+
+/* uid and gid are 32 bit, (uid_t)-1 is not a valid user, so a memo of all bits set never matches. */
+static const std::uint64_t NO_MEMO = UINT64_MAX;
+
+static std::uint64_t memo_key(std::uint32_t uid, std::uint32_t gid)
+{
+    return (static_cast<std::uint64_t>(uid) << 32) | gid;
+}
+
+template<typename T>
+static void sort_unique(std::vector<T> &v)
+{
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+}
+
+PathPermission::PathPermission(const google::protobuf::RepeatedPtrField<hflat::Metadata_ReachabilityEntry> &entries) :
+        deny_all(false), require_uid(false), uid(0), require_gid(false), gid(0), last_allowed(NO_MEMO), last_denied(NO_MEMO)
+{
+    auto require = [this](bool &required, std::uint32_t &id, std::uint32_t e){
+        if (required && id != e)
+            deny_all = true;
+        required = true;
+        id = e;
+    };
+
+    for (int i = 0; i < entries.size(); i++) {
+        const hflat::Metadata_ReachabilityEntry &e = entries.Get(i);
+
+        switch (e.type()) {
+        case hflat::Metadata_ReachabilityType_UID:
+            require(require_uid, uid, e.uid());
+            break;
+        case hflat::Metadata_ReachabilityType_GID:
+            require(require_gid, gid, e.gid());
+            break;
+        case hflat::Metadata_ReachabilityType_UID_OR_GID:
+            uid_or_gid.push_back(IdPair(e.uid(), e.gid()));
+            break;
+        case hflat::Metadata_ReachabilityType_NOT_UID:
+            not_uid.push_back(e.uid());
+            break;
+        case hflat::Metadata_ReachabilityType_NOT_GID:
+            not_gid.push_back(e.gid());
+            break;
+        case hflat::Metadata_ReachabilityType_GID_REQ_UID:
+            gid_req_uid.push_back(IdPair(e.gid(), e.uid()));
+            break;
+        }
+    }
+    sort_unique(not_uid);
+    sort_unique(not_gid);
+    sort_unique(uid_or_gid);
+    sort_unique(gid_req_uid);
+}
+
+/* For full functionality, all group checks should do in_group checks instead of straight
+ * comparisons, compare chown. */
+bool PathPermission::evaluate(std::uint32_t u, std::uint32_t g) const
+{
+    if (deny_all)
+        return false;
+    if (require_uid && u != uid)
+        return false;
+    if (require_gid && g != gid)
+        return false;
+    if (std::binary_search(not_uid.begin(), not_uid.end(), u))
+        return false;
+    if (std::binary_search(not_gid.begin(), not_gid.end(), g))
+        return false;
+
+    /* Members of the group have to be the owner. */
+    auto range = std::equal_range(gid_req_uid.begin(), gid_req_uid.end(), IdPair(g, 0),
+            [](const IdPair &lhs, const IdPair &rhs){ return lhs.first < rhs.first; });
+    for (auto it = range.first; it != range.second; it++)
+        if (it->second != u)
+            return false;
+
+    /* Entries owned by the user are satisfied, all others require group membership. */
+    for (auto it = uid_or_gid.begin(); it != uid_or_gid.end(); it++)
+        if (it->first != u && it->second != g)
+            return false;
+    return true;
+}
+
+int PathPermission::check(std::uint32_t u, std::uint32_t g) const
+{
+    std::uint64_t key = memo_key(u, g);
+    if (last_allowed.load(std::memory_order_relaxed) == key)
+        return 0;
+    if (last_denied.load(std::memory_order_relaxed) == key)
+        return -EACCES;
+
+    if (evaluate(u, g)) {
+        last_allowed.store(key, std::memory_order_relaxed);
+        return 0;
+    }
+    last_denied.store(key, std::memory_order_relaxed);
+    return -EACCES;
+}
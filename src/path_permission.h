@@ -0,0 +1,56 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PATH_PERMISSION_H_
+#define PATH_PERMISSION_H_
+#include "metadata.pb.h"
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+/* Compiled form of a set of reachability entries (compare metadata.proto). Duplicate entries are removed and
+ * the remaining entries are sorted by type and id, so that a uid / gid pair can be checked with a few binary
+ * searches instead of walking the protobuf entries. The last allowed and denied uid / gid pairs are remembered,
+ * repeated checks by the same user are answered without evaluating the table. */
+class PathPermission final
+{
+private:
+    typedef std::pair<std::uint32_t, std::uint32_t> IdPair;
+
+    bool                        deny_all;      // contradicting UID or GID requirements
+    bool                        require_uid;
+    std::uint32_t               uid;
+    bool                        require_gid;
+    std::uint32_t               gid;
+    std::vector<std::uint32_t>  not_uid;       // sorted
+    std::vector<std::uint32_t>  not_gid;       // sorted
+    std::vector<IdPair>         uid_or_gid;    // sorted (uid,gid)
+    std::vector<IdPair>         gid_req_uid;   // sorted (gid,uid)
+
+    mutable std::atomic<std::uint64_t> last_allowed;
+    mutable std::atomic<std::uint64_t> last_denied;
+
+private:
+    bool evaluate(std::uint32_t uid, std::uint32_t gid) const;
+
+public:
+    explicit PathPermission(const google::protobuf::RepeatedPtrField<hflat::Metadata_ReachabilityEntry> &entries);
+
+    /* Returns 0 if the supplied user may pass, -EACCES otherwise. */
+    int check(std::uint32_t uid, std::uint32_t gid) const;
+};
+
+#endif /* PATH_PERMISSION_H_ */
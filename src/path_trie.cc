@@ -0,0 +1,179 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "path_trie.h"
+
+namespace {
+struct Component
+{
+    const char *data;
+    std::size_t length;
+};
+
+template<typename NodePtr>
+bool component_less(const NodePtr &node, const Component &c)
+{
+    return node->component.compare(0, std::string::npos, c.data, c.length) < 0;
+}
+
+/* Position of the first child with a component not less than c */
+template<typename Children>
+auto lower_bound(Children &children, const Component &c) -> decltype(children.begin())
+{
+    return std::lower_bound(children.begin(), children.end(), c, component_less<typename Children::value_type>);
+}
+
+/* The component of key starting at start and the start of the following component (npos for the last component). */
+Component component(const std::string &key, std::size_t start, std::size_t &next)
+{
+    std::size_t end = key.find('/', start);
+    next = end == std::string::npos ? end : end + 1;
+    return Component { key.data() + start, (end == std::string::npos ? key.size() : end) - start };
+}
+}
+
+PathTrie::PathTrie() :
+        root(std::make_shared<Node>())
+{
+    writable(root)->mapped = false;
+    writable(root)->mappings = 0;
+}
+
+PathTrie::~PathTrie()
+{
+}
+
+std::size_t PathTrie::size() const
+{
+    return root->mappings;
+}
+
+bool PathTrie::empty() const
+{
+    return root->mappings == 0;
+}
+
+/* A node can be changed in place if this trie is its only owner. Nodes are only reached through their parent,
+ * so this holds for every node on a path of unshared nodes starting at the root. */
+PathTrie::Node *PathTrie::writable(std::shared_ptr<const Node> &node)
+{
+    if (node.use_count() != 1)
+        node = std::make_shared<Node>(*node);
+    return const_cast<Node *>(node.get());
+}
+
+const PathTrie::Node *PathTrie::child(const Node &node, const char *data, std::size_t length)
+{
+    Component c { data, length };
+    auto it = lower_bound(node.children, c);
+    if (it == node.children.end() || (*it)->component.compare(0, std::string::npos, data, length))
+        return nullptr;
+    return it->get();
+}
+
+const PMEntry *PathTrie::find(const std::string &key) const
+{
+    const Node *node = root.get();
+    for (std::size_t start = 0; start != std::string::npos && node; ) {
+        std::size_t next;
+        Component c = component(key, start, next);
+        node = child(*node, c.data, c.length);
+        start = next;
+    }
+    return node && node->mapped ? &node->entry : nullptr;
+}
+
+void PathTrie::set(const std::string &key, const PMEntry &entry)
+{
+    std::vector<Node *> path(1, writable(root));
+    for (std::size_t start = 0; start != std::string::npos; ) {
+        std::size_t next;
+        Component c = component(key, start, next);
+        auto &children = path.back()->children;
+        auto it = lower_bound(children, c);
+        if (it == children.end() || (*it)->component.compare(0, std::string::npos, c.data, c.length)) {
+            std::shared_ptr<Node> node = std::make_shared<Node>();
+            node->component.assign(c.data, c.length);
+            node->mapped = false;
+            node->mappings = 0;
+            it = children.insert(it, node);
+        }
+        path.push_back(writable(*it));
+        start = next;
+    }
+
+    Node *node = path.back();
+    if (!node->mapped)
+        for (auto n : path)
+            n->mappings++;
+    node->mapped = true;
+    node->entry = entry;
+}
+
+/* key is known to be mapped below node */
+void PathTrie::erase(Node &node, const std::string &key, std::size_t start)
+{
+    std::size_t next;
+    Component c = component(key, start, next);
+    auto it = lower_bound(node.children, c);
+
+    Node &n = *writable(*it);
+    if (next != std::string::npos)
+        erase(n, key, next);
+    else {
+        n.mapped = false;
+        n.entry = PMEntry();
+        n.mappings--;
+    }
+
+    /* Remove subtrees without mappings */
+    if (n.mappings == 0)
+        node.children.erase(it);
+    node.mappings--;
+}
+
+void PathTrie::erase(const std::string &key)
+{
+    if (find(key))
+        erase(*writable(root), key, 0);
+}
+
+void PathTrie::clear()
+{
+    PathTrie empty;
+    root = empty.root;
+}
+
+void PathTrie::forEach(const Node &node, std::string &key, bool first, const std::function<void(const std::string&, const PMEntry&)> &fn)
+{
+    std::size_t length = key.size();
+    for (auto &c : node.children) {
+        /* components of the first level are not preceded by a '/' */
+        if (!first)
+            key.append("/");
+        key.append(c->component);
+        if (c->mapped)
+            fn(key, c->entry);
+        forEach(*c, key, false, fn);
+        key.resize(length);
+    }
+}
+
+void PathTrie::forEach(const std::function<void(const std::string&, const PMEntry&)> &fn) const
+{
+    std::string key;
+    forEach(*root, key, true, fn);
+}
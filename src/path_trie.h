@@ -0,0 +1,140 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PATH_TRIE_H_
+#define PATH_TRIE_H_
+#include "database.pb.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+
+struct PMEntry
+{
+    hflat::MappingType      type;
+    std::string             target;
+    std::int64_t            permissionTimeStamp;
+    bool                    removed;    // hides a mapping of an underlying snapshot, compare PathMapDB
+};
+
+/* Path mappings indexed by path component. Keys are split at '/', every node stores the number of mappings in its
+ * subtree and subtrees without mappings are removed. All mappings that are a prefix of a path are therefore found
+ * in a single walk from the root, which ends as soon as no deeper mapping exists. Children are kept sorted by
+ * component so that they can be searched directly on the path buffer.
+ *
+ * Copies of a trie share their nodes. Nodes are only modified in place if they are not shared, otherwise the path
+ * from the root to the changed node is copied first. A copy of a trie can therefore be changed while other threads
+ * keep reading the original. */
+class PathTrie final
+{
+private:
+    struct Node
+    {
+        std::string                         component;
+        bool                                mapped;
+        PMEntry                             entry;
+        std::size_t                         mappings;   // in this subtree, including this node
+        std::vector<std::shared_ptr<const Node>> children;   // sorted by component
+    };
+    std::shared_ptr<const Node> root;
+
+private:
+    static Node *writable(std::shared_ptr<const Node> &node);
+    static const Node *child(const Node &node, const char *component, std::size_t length);
+    static void erase(Node &node, const std::string &key, std::size_t start);
+    static void forEach(const Node &node, std::string &key, bool first, const std::function<void(const std::string&, const PMEntry&)> &fn);
+
+public:
+    /* Walks down the trie one component at a time. */
+    class Cursor final
+    {
+    private:
+        const Node *node;
+
+    public:
+        explicit Cursor(const PathTrie &trie) : node(trie.root.get()) {}
+
+        /* Returns false if there is no mapping at or below the child. */
+        bool descend(const char *component, std::size_t length)
+        {
+            return node && (node = child(*node, component, length));
+        }
+        const PMEntry *entry() const
+        {
+            return node && node->mapped ? &node->entry : nullptr;
+        }
+        bool hasDescendants() const
+        {
+            return node && node->mappings > (node->mapped ? 1 : 0);
+        }
+    };
+
+public:
+    explicit PathTrie();
+    ~PathTrie();
+
+public:
+    std::size_t size() const;
+    bool empty() const;
+
+    /* Returns the mapping stored for key or nullptr */
+    const PMEntry *find(const std::string &key) const;
+    void set(const std::string &key, const PMEntry &entry);
+    void erase(const std::string &key);
+    void clear();
+
+    /* Calls fn for every key / mapping pair, in key order. */
+    void forEach(const std::function<void(const std::string&, const PMEntry&)> &fn) const;
+
+    /* Returns the mapping of the longest prefix of path (ending at a component boundary) for which applies(entry, last)
+     * returns true, last is set if the prefix is the full path. The prefix length is stored in prefix. timeStamp is
+     * raised to the maximum permission timestamp of the returned mapping and all longer mapped prefixes, or of all
+     * mapped prefixes if no mapping applies. */
+    template<typename Applies>
+    const PMEntry *longestPrefix(const std::string &path, std::size_t &prefix, std::int64_t &timeStamp, Applies applies) const
+    {
+        const PMEntry *match = nullptr;
+        std::int64_t stamp = std::numeric_limits<std::int64_t>::min();
+        const Node *node = root.get();
+
+        for (std::size_t start = 0; node->mappings > (node->mapped ? 1 : 0); ) {
+            std::size_t end = path.find('/', start);
+            bool last = end == std::string::npos;
+            if (!(node = child(*node, path.data() + start, (last ? path.size() : end) - start)))
+                break;
+
+            if (node->mapped) {
+                if (applies(node->entry, last)) {
+                    match  = &node->entry;
+                    prefix = last ? path.size() : end;
+                    stamp  = node->entry.permissionTimeStamp;
+                }
+                else
+                    stamp = std::max(stamp, node->entry.permissionTimeStamp);
+            }
+            if (last)
+                break;
+            start = end + 1;
+        }
+        timeStamp = std::max(timeStamp, stamp);
+        return match;
+    }
+};
+
+#endif /* PATH_TRIE_H_ */
@@ -16,17 +16,17 @@
  */
 #include "pathmap_db.h"
 #include <sys/param.h> /* Just for MAXSYMLINKS #define */ 
-#include <thread>
-#include <chrono>
 #include <iostream>
 #include <iomanip>
 #include <cassert>
+#include <algorithm>
+#include <limits>
 #include "debug.h"
 
 using hflat::MappingType;
 
 PathMapDB::PathMapDB() :
-        snapshotVersion(0), snapshot(), currentReaders(), lock()
+        current(new Snapshot { 0, nullptr, PathTrie(), 0 }), lock(), file_lock()
 {
 }
 
@@ -34,19 +34,120 @@ PathMapDB::~PathMapDB()
 {
 }
 
-std::int64_t PathMapDB::getSnapshotVersion() const
+const PMEntry *PathMapDB::Snapshot::find(const std::string &key, PMEntry &buffer) const
 {
-    std::lock_guard<std::mutex> locker(lock);
-    return snapshotVersion;
+    if (const PMEntry *e = mappings.find(key))
+        return e->removed ? nullptr : e;
+    bool descendants;
+    if (base && base->find(key.data(), key.size(), buffer, descendants))
+        return &buffer;
+    return nullptr;
 }
 
-bool PathMapDB::searchPathRecursive(std::string& path, std::int64_t &maxTimeStamp, const bool followReuse, const bool followSymlink) const
+void PathMapDB::Snapshot::set(const std::string &key, const PMEntry &entry)
 {
-    /* Found path in snapshot */
-    if (snapshot.count(path)) {
-        /* Store maximum encountered timestamp */
-        maxTimeStamp = std::max(maxTimeStamp, snapshot.at(path).permissionTimeStamp);
+    PMEntry buffer;
+    if (!find(key, buffer))
+        size++;
+    mappings.set(key, entry);
+}
+
+void PathMapDB::Snapshot::erase(const std::string &key)
+{
+    PMEntry buffer;
+    bool descendants;
+    if (!find(key, buffer))
+        return;
+    size--;
+
+    /* Mappings of the base can't be removed, hide them instead. */
+    if (base && base->find(key.data(), key.size(), buffer, descendants))
+        mappings.set(key, PMEntry { MappingType::NONE, std::string(), 0, true });
+    else
+        mappings.erase(key);
+}
+
+void PathMapDB::Snapshot::forEach(const std::function<void(const std::string&, const PMEntry&)> &fn) const
+{
+    if (!base)
+        return mappings.forEach(fn);
+
+    /* Merge both sorted sequences, changes are usually few compared to the base. */
+    std::vector<std::pair<std::string, PMEntry>> changes;
+    mappings.forEach([&changes](const std::string &key, const PMEntry &e){ changes.emplace_back(key, e); });
+
+    auto change = changes.begin();
+    auto changed = [&fn](const std::pair<std::string, PMEntry> &c){
+        if (!c.second.removed)
+            fn(c.first, c.second);
+    };
+    base->forEach([&](const std::string &key, const PMEntry &e){
+        for (; change != changes.end() && SnapshotFile::compare(change->first.data(), change->first.size(), key.data(), key.size()) < 0; ++change)
+            changed(*change);
+        if (change != changes.end() && change->first == key)
+            changed(*change++);
+        else
+            fn(key, e);
+    });
+    for (; change != changes.end(); ++change)
+        changed(*change);
+}
 
+/* Equivalent to PathTrie::longestPrefix() on the merged mappings of base and trie. Mappings of the base that are
+ * returned are stored in buffer. */
+template<typename Applies>
+const PMEntry *PathMapDB::Snapshot::longestPrefix(const std::string &path, std::size_t &prefix, std::int64_t &timeStamp, Applies applies, PMEntry &buffer) const
+{
+    const PMEntry *match = nullptr;
+    std::int64_t stamp = std::numeric_limits<std::int64_t>::min();
+    PathTrie::Cursor cursor(mappings);
+    PMEntry scratch;
+    bool descendants = base->size() > 0;
+
+    for (std::size_t start = 0; cursor.hasDescendants() || descendants; ) {
+        std::size_t end = path.find('/', start);
+        bool last = end == std::string::npos;
+        std::size_t length = last ? path.size() : end;
+
+        cursor.descend(path.data() + start, length - start);
+        bool based = descendants && base->find(path.data(), length, scratch, descendants);
+        const PMEntry *e = cursor.entry();
+        if (e && e->removed)
+            e = nullptr;
+        else if (!e && based)
+            e = &scratch;
+
+        if (e) {
+            if (applies(*e, last)) {
+                if (e == &scratch) {
+                    std::swap(buffer, scratch);
+                    e = &buffer;
+                }
+                match  = e;
+                prefix = length;
+                stamp  = e->permissionTimeStamp;
+            }
+            else
+                stamp = std::max(stamp, e->permissionTimeStamp);
+        }
+        if (last)
+            break;
+        start = end + 1;
+    }
+    timeStamp = std::max(timeStamp, stamp);
+    return match;
+}
+
+std::int64_t PathMapDB::getSnapshotVersion() const
+{
+    return std::atomic_load(&current)->version;
+}
+
+/* Find the longest prefix of path that has an applicable mapping in a single walk of the snapshot index.
+ * Returns the mapping and stores the prefix length or returns nullptr if no mapping applies. */
+const PMEntry *PathMapDB::searchPath(const Snapshot &s, const std::string &path, std::size_t &prefix, std::int64_t &maxTimeStamp, bool followReuse, bool followSymlink, PMEntry &buffer)
+{
+    auto applies = [&](const PMEntry &e, bool last) -> bool {
         /* There are a number of cases where we DO NOT want to remap the path even though we found it in the snapshot.
          *
          * 1) A MappingType::NONE mapping does not have a destination
@@ -60,68 +161,65 @@ bool PathMapDB::searchPathRecursive(std::string& path, std::int64_t &maxTimeStam
          * At the same time we keep correct functionality for links: calls to 'l' are mapped to '*a'.
          *
          * */
-        if ((snapshot.at(path).type == MappingType::NONE) || (!followSymlink && snapshot.at(path).type == MappingType::SYMLINK)
-                || (!followReuse && snapshot.at(path).type == MappingType::REUSE)) { /*don't remap*/
-        } else
-            return true;
-    }
-
-    /* Remove last path component and continue if possible */
-    auto pos = path.find_last_of("/");
-
-    /* Take this opportunity to check for component-by-component POSIX name compliance. */
-    if (path.size() - 1 - pos > NAME_MAX) {
-        hflat_debug("Last component of path '%s' has %d size.",path.c_str(),path.size()-1-pos);
-        maxTimeStamp = -ENAMETOOLONG;
-        return false;
+        return !((e.type == MappingType::NONE) || (last && !followSymlink && e.type == MappingType::SYMLINK)
+                || (!followReuse && e.type == MappingType::REUSE));
+    };
+    const PMEntry *e = s.base ? s.longestPrefix(path, prefix, maxTimeStamp, applies, buffer) :
+                                s.mappings.longestPrefix(path, prefix, maxTimeStamp, applies);
+
+    /* Take this opportunity to check for component-by-component POSIX name compliance of the components that are not remapped. */
+    for (std::size_t start = e ? prefix + 1 : 0; start <= path.size(); ) {
+        std::size_t end = std::min(path.find('/', start), path.size());
+        if (end - start > NAME_MAX) {
+            hflat_debug("Component of path '%s' has %d size.", path.c_str(), end - start);
+            maxTimeStamp = -ENAMETOOLONG;
+            return nullptr;
+        }
+        start = end + 1;
     }
-    if (pos == std::string::npos)
-        return false;
-    path.erase(pos, std::string::npos);
-    return searchPathRecursive(path, maxTimeStamp, followReuse, true);
+    return e;
 }
 
 void PathMapDB::iointercept(std::string &path) const
 {
        /* In order to support direct lookup via iointercept, undo path manipulation if appropiate. */
-       size_t pos = path.find_first_of(':');
+       size_t pos = path.find(':');
 
        if(pos == std::string::npos)
            return;
 
        /* Step1) remove virtual directory. */
-       size_t end = path.find_first_of('/',pos);
+       size_t end = path.find('/',pos);
        path.erase(pos,end-pos+1);
 
-       /* Step2) substitute slashes back in. */
-
-       while((pos = path.find_first_of(':')) != std::string::npos)
-           path[pos]='/';
+       /* Step2) substitute slashes back in. No ':' exists in front of the virtual directory, so a single pass
+        * over the remainder of the path is sufficient. */
+       std::replace(path.begin() + pos, path.end(), ':', '/');
 }
 
-std::string PathMapDB::toSystemPath(const char *user_path, std::int64_t &maxTimeStamp, CallingType ctype) const
+void PathMapDB::toSystemPath(const char *user_path, std::string &systemPath, std::int64_t &maxTimeStamp, CallingType ctype) const
 {
     int numLinksFollowed = 0;
     bool followReuse = true;
     bool followSymlink = ctype == CallingType::LOOKUP ? false : true;
     maxTimeStamp = 0;
-    std::string systemPath(user_path);
+    systemPath.assign(user_path);
     iointercept(systemPath);
-    std::string temp(systemPath);
 
     /* Take this opportunity to check for path POSIX name compliance. */
-    if (temp.size() > PATH_MAX) {
-        hflat_debug("path size for %s is %d. Maximum is %d",temp.c_str(),temp.size(),PATH_MAX);
+    if (systemPath.size() > PATH_MAX) {
+        hflat_debug("path size for %s is %d. Maximum is %d",systemPath.c_str(),systemPath.size(),PATH_MAX);
         maxTimeStamp = -ENAMETOOLONG;
-        return systemPath;
-    }
-    {
-        std::lock_guard<std::mutex> locker(lock);
-        ++currentReaders;
+        return;
     }
 
-    while (searchPathRecursive(temp, maxTimeStamp, followReuse, followSymlink)) {
-        if (snapshot.at(temp).type == MappingType::SYMLINK) {
+    /* The whole path is remapped using the same snapshot, even if a new one is published meanwhile. */
+    std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&current);
+    const PMEntry *e;
+    PMEntry buffer;
+    std::size_t prefix = 0;
+    while ((e = searchPath(*snapshot, systemPath, prefix, maxTimeStamp, followReuse, followSymlink, buffer))) {
+        if (e->type == MappingType::SYMLINK) {
             /* Guard against symbolic link loops */
             if (++numLinksFollowed > MAXSYMLINKS) {
                 maxTimeStamp = -ELOOP;
@@ -129,136 +227,206 @@ std::string PathMapDB::toSystemPath(const char *user_path, std::int64_t &maxTime
             }
         }
         /* Don't follow reuse mapping after a move mapping. */
-        followReuse = (snapshot.at(temp).type == MappingType::MOVE) ? false : true;
+        followReuse = (e->type == MappingType::MOVE) ? false : true;
 
         /* Apply mapping to path */
-        temp = systemPath.replace(0, temp.size(), snapshot.at(temp).target);
+        systemPath.replace(0, prefix, e->target);
     }
-
-    --currentReaders;
-    return systemPath;
 }
 
-hflat::db_snapshot PathMapDB::serializeSnapshot()
+std::size_t PathMapDB::getSnapshotSize() const
 {
-    hflat::db_snapshot s;
-
-    std::lock_guard<std::mutex> locker(lock);
-    while (currentReaders.load())
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-
-    hflat_debug("Serializing snapshot version %d.",snapshotVersion);
-
-    for( auto e : snapshot ){
-        hflat::db_snapshot_entry * re = s.add_entries();
+    return std::atomic_load(&current)->size;
+}
 
-        re->set_origin(e.first);
-        re->set_target(e.second.target);
-        re->set_type(e.second.type);
-        re->set_permissiontimestamp(e.second.permissionTimeStamp);
+int PathMapDB::serializeSnapshot(std::size_t chunkBytes, std::int64_t &version, const std::function<int(const hflat::db_snapshot &chunk)> &store) const
+{
+    /* Published snapshots don't change, writers can proceed while the snapshot is being serialized. */
+    std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&current);
+    version = snapshot->version;
+    hflat_debug("Serializing snapshot version %d.",version);
+
+    hflat::db_snapshot chunk;
+    chunk.set_snapshot_version(version);
+    std::size_t bytes = 0;
+    int chunks = 0;
+    int err = 0;
+
+    snapshot->forEach([&](const std::string &origin, const PMEntry &e){
+        if (err)
+            return;
+        hflat::db_snapshot_entry * re = chunk.add_entries();
+
+        re->set_origin(origin);
+        re->set_target(e.target);
+        re->set_type(e.type);
+        re->set_permissiontimestamp(e.permissionTimeStamp);
+
+        /* entry size plus tag and length prefix */
+        bytes += re->ByteSize() + 4;
+        if (bytes >= chunkBytes) {
+            err = store(chunk);
+            chunks++;
+            chunk.clear_entries();
+            bytes = 0;
+        }
+    });
+    /* Always store at least one chunk, so that an empty snapshot can be told apart from a missing one. */
+    if (!err && (chunk.entries_size() || chunks == 0)) {
+        err = store(chunk);
+        chunks++;
     }
-    s.set_snapshot_version(snapshotVersion);
-    return s;
+    return err ? err : chunks;
 }
 
-int PathMapDB::loadSnapshot(const hflat::db_snapshot & serialized)
+int PathMapDB::loadSnapshot(std::int64_t version, const std::vector<hflat::db_snapshot> &chunks)
 {
-    hflat_debug("Current snapshot version is %d, loading remote snapshot version %d. ", snapshotVersion, serialized.snapshot_version());
+    hflat_debug("Current snapshot version is %d, loading remote snapshot version %d. ", getSnapshotVersion(), version);
 
     /* No need to update */
-    if (serialized.snapshot_version() <= snapshotVersion)
+    if (version <= getSnapshotVersion())
         return 0;
 
+    /* Build the new snapshot before taking the lock, nobody else can see it yet. */
+    std::shared_ptr<Snapshot> snapshot(new Snapshot { version, nullptr, PathTrie(), 0 });
+    for (auto &chunk : chunks) {
+        if (chunk.snapshot_version() != version)
+            return -EINVAL;
+        for( auto &e : chunk.entries() )
+            snapshot->mappings.set(e.origin(), PMEntry { e.type(), e.has_target() ? e.target() : "", e.permissiontimestamp(), false });
+    }
+    snapshot->size = snapshot->mappings.size();
+
+    std::lock_guard<std::mutex> locker(lock);
+    if (version > std::atomic_load(&current)->version)
+        std::atomic_store(&current, std::shared_ptr<const Snapshot>(snapshot));
+    return 0;
+}
+
+int PathMapDB::loadSnapshotFile(const std::string &filename)
+{
+    int err;
+    std::shared_ptr<const SnapshotFile> file = SnapshotFile::open(filename, err);
+    if (!file)
+        return err;
+    hflat_debug("Current snapshot version is %d, loading snapshot file version %d. ", getSnapshotVersion(), file->version());
+
     std::lock_guard<std::mutex> locker(lock);
-    while (currentReaders.load())
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (file->version() > std::atomic_load(&current)->version)
+        std::atomic_store(&current, std::shared_ptr<const Snapshot>(new Snapshot { file->version(), file, PathTrie(), file->size() }));
+    return 0;
+}
 
-    this->snapshotVersion = serialized.snapshot_version();
-    this->snapshot.clear();
-    for( auto e : serialized.entries() )
-        snapshot[e.origin()] = PMEntry { e.type(), e.has_target() ? e.target() : "", e.permissiontimestamp()};
+int PathMapDB::saveSnapshotFile(const std::string &filename)
+{
+    std::lock_guard<std::mutex> file_locker(file_lock);
 
+    /* Published snapshots don't change, writers can proceed while the snapshot is being written. */
+    std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&current);
+    if (snapshot->base && snapshot->base->version() == snapshot->version)
+        return 0;
+    SnapshotFile::Writer writer;
+    snapshot->forEach([&writer](const std::string &key, const PMEntry &e){ writer.add(key, e); });
+    if (int err = writer.write(filename, snapshot->version))
+        return err;
+
+    /* Changes applied in the meantime would be lost by switching to the file. */
+    int err;
+    std::shared_ptr<const SnapshotFile> file = SnapshotFile::open(filename, err);
+    if (!file)
+        return err;
+    std::lock_guard<std::mutex> locker(lock);
+    if (file->version() == std::atomic_load(&current)->version)
+        std::atomic_store(&current, std::shared_ptr<const Snapshot>(new Snapshot { file->version(), file, PathTrie(), file->size() }));
     return 0;
 }
 
+void PathMapDB::clear()
+{
+    std::lock_guard<std::mutex> locker(lock);
+    std::atomic_store(&current, std::shared_ptr<const Snapshot>(new Snapshot { 0, nullptr, PathTrie(), 0 }));
+}
+
 int PathMapDB::updateSnapshot(const std::list<hflat::db_entry> &entries, std::int64_t fromVersion, std::int64_t toVersion)
 {
+    std::lock_guard<std::mutex> locker(lock);
+    std::shared_ptr<Snapshot> snapshot(new Snapshot(*std::atomic_load(&current)));
+
     /* sanity checks */
     assert(entries.size() == (size_t )(toVersion - fromVersion));
-    assert(fromVersion <= snapshotVersion);
-    hflat_debug("Current snapshot version = %d, updating interval [%d , %d]", snapshotVersion, fromVersion, toVersion);
+    assert(fromVersion <= snapshot->version);
+    hflat_debug("Current snapshot version = %d, updating interval [%d , %d]", snapshot->version, fromVersion, toVersion);
 
     /* No need to update */
-    if (toVersion <= snapshotVersion)
+    if (toVersion <= snapshot->version)
         return 0;
 
-    std::int64_t currentVersion = snapshotVersion;
+    /* Entries up to the current snapshot version might have been applied by another thread in the meantime. */
+    std::int64_t entryVersion = fromVersion;
     for (auto& entry : entries) {
-        currentVersion++;
-
-        if (currentVersion < fromVersion)
+        if (++entryVersion <= snapshot->version)
             continue;
 
         switch (entry.type()) {
         case hflat::db_entry_Type_MOVE:
-            addDirectoryMove(entry.origin(), entry.target());
+            applyDirectoryMove(*snapshot, entry.origin(), entry.target());
             break;
         case hflat::db_entry_Type_SYMLINK:
-            addSoftLink(entry.origin(), entry.target());
+            applySoftLink(*snapshot, entry.origin(), entry.target());
             break;
         case hflat::db_entry_Type_NONE:
-            addPermissionChange(entry.origin());
+            applyPermissionChange(*snapshot, entry.origin());
             break;
         case hflat::db_entry_Type_REMOVED:
-            addUnlink(entry.origin());
+            applyUnlink(*snapshot, entry.origin());
             break;
         default:
             hflat_warning("Invalid database entry supplied. Resetting pathmapDB");
-            std::lock_guard<std::mutex> locker(lock);
-            while (currentReaders.load())
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            this->snapshot.clear();
-            this->snapshotVersion = 0;
+            std::atomic_store(&current, std::shared_ptr<const Snapshot>(new Snapshot { 0, nullptr, PathTrie(), 0 }));
             return -EINVAL;
         }
     }
-    snapshotVersion = toVersion;
+    snapshot->version = toVersion;
+    std::atomic_store(&current, std::shared_ptr<const Snapshot>(snapshot));
+    printSnapshot();
     return 0;
 }
 
-void PathMapDB::addSoftLink(std::string origin, std::string destination)
+/* Apply a single change to a copy of the current snapshot and publish it. */
+template<typename Update>
+void PathMapDB::publish(Update update)
 {
-    iointercept(origin); iointercept(destination);
     std::lock_guard<std::mutex> locker(lock);
-    while (currentReaders.load())
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::shared_ptr<Snapshot> snapshot(new Snapshot(*std::atomic_load(&current)));
+    update(*snapshot);
+    std::atomic_store(&current, std::shared_ptr<const Snapshot>(snapshot));
+}
 
-    snapshotVersion++;
+void PathMapDB::applySoftLink(Snapshot &s, std::string origin, std::string destination) const
+{
+    iointercept(origin); iointercept(destination);
+    s.version++;
 
-    if (snapshot.count(origin))
-        assert(snapshot[origin].type == MappingType::REUSE);
+    PMEntry buffer;
+    const PMEntry *reuse = s.find(origin, buffer);
+    if (reuse)
+        assert(reuse->type == MappingType::REUSE);
 
     /* Keep possibly existing reuse move mapping in order to enable lookups on the inode of the
      * symbolic link. */
-    snapshot[ snapshot.count(origin) ? snapshot[origin].target : origin ] =
-    {   MappingType::SYMLINK, std::string(destination), 0};
-    printSnapshot();
+    std::string key = reuse ? reuse->target : origin;
+    s.set(key, {MappingType::SYMLINK, destination, 0, false});
 }
 
-void PathMapDB::addPermissionChange(std::string path)
+void PathMapDB::applyPermissionChange(Snapshot &s, std::string path) const
 {
     iointercept(path);
-    std::lock_guard<std::mutex> locker(lock);
-    while (currentReaders.load())
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-
-    snapshotVersion++;
+    s.version++;
 
-    int exist = snapshot.count(path);
-    snapshot[path] = exist ? PMEntry { snapshot[path].type, snapshot[path].target, snapshotVersion } :
-                             PMEntry { MappingType::NONE, std::string(), snapshotVersion };
-
-    printSnapshot();
+    PMEntry buffer;
+    const PMEntry *exist = s.find(path, buffer);
+    s.set(path, exist ? PMEntry { exist->type, exist->target, s.version, false } :
+                        PMEntry { MappingType::NONE, std::string(), s.version, false });
 }
 
 /* Keep in mind that the client validated the operation against the file system at this point. This means: 
@@ -266,20 +434,18 @@ void PathMapDB::addPermissionChange(std::string path)
  * the path 'destination' does not exist or is an empty directory. 
  * the path 'destination' does not specify a sub-directory of 'origin'
  * access permissions are validated. */
-void PathMapDB::addDirectoryMove(std::string origin, std::string destination)
+void PathMapDB::applyDirectoryMove(Snapshot &s, std::string origin, std::string destination) const
 {
     iointercept(origin); iointercept(destination);
-    std::lock_guard<std::mutex> locker(lock);
-    while (currentReaders.load())
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-
-    snapshotVersion++;
+    s.version++;
 
     /* No existing mapping... the standard case. 
      * mv /a /b  [b->a, a->X]  */
-    if (!snapshot.count(origin)) {
-        snapshot[destination] = {MappingType::MOVE, origin, 0};
-        snapshot[origin] = {MappingType::REUSE, "|reuse_"+std::to_string(snapshotVersion), 0};
+    PMEntry buffer;
+    const PMEntry *existing = s.find(origin, buffer);
+    if (!existing) {
+        s.set(destination, {MappingType::MOVE, origin, 0, false});
+        s.set(origin, {MappingType::REUSE, "|reuse_"+std::to_string(s.version), 0, false});
     }
 
     /* There's an existing mapping with key==origin, update it. If existing mapping is of type REUSE a new REUSE mapping has to be generated.
@@ -288,47 +454,67 @@ void PathMapDB::addDirectoryMove(std::string origin, std::string destination)
      * mv /a /d [c->a, d->X1, a->X2]
      */
     else {
-        MappingType type = snapshot[origin].type;
-        assert(type == MappingType::MOVE || type == MappingType::REUSE);
+        PMEntry e = *existing;
+        assert(e.type == MappingType::MOVE || e.type == MappingType::REUSE);
 
-        snapshot[destination] = {MappingType::MOVE, snapshot[origin].target, snapshot[origin].permissionTimeStamp};
+        s.set(destination, {MappingType::MOVE, e.target, e.permissionTimeStamp, false});
 
-        if(type == MappingType::REUSE)
-        snapshot[origin].target = "|reuse_"+std::to_string(snapshotVersion);
+        if(e.type == MappingType::REUSE)
+        s.set(origin, {e.type, "|reuse_"+std::to_string(s.version), e.permissionTimeStamp, false});
         else
-        snapshot.erase(origin);
+        s.erase(origin);
     }
 
     /* Special case: Circular move 
      *  mv /a /b [b->a, a->X]
      *  mv /b /a [] */
-    if (destination == snapshot[destination].target) {
-        snapshot.erase(destination);
-        snapshot.erase(origin);
+    if (destination == s.find(destination, buffer)->target) {
+        s.erase(destination);
+        s.erase(origin);
     }
-    printSnapshot();
 }
 
-void PathMapDB::addUnlink(std::string path)
+void PathMapDB::applyUnlink(Snapshot &s, std::string path) const
 {
     iointercept(path);
-    std::lock_guard<std::mutex> locker(lock);
-    while (currentReaders.load())
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-
-    snapshotVersion++;
+    s.version++;
 
-    if(!snapshot.count(path))
+    PMEntry buffer;
+    if(!s.find(path, buffer))
         hflat_warning("Received addUnlink request for key %s that IS NOT in the current database.", path.data());
 
-    snapshot.erase(path);
+    s.erase(path);
+}
+
+void PathMapDB::addSoftLink(std::string origin, std::string destination)
+{
+    publish([&](Snapshot &s){ applySoftLink(s, origin, destination); });
+    printSnapshot();
+}
+
+void PathMapDB::addPermissionChange(std::string path)
+{
+    publish([&](Snapshot &s){ applyPermissionChange(s, path); });
+    printSnapshot();
+}
+
+void PathMapDB::addDirectoryMove(std::string origin, std::string destination)
+{
+    publish([&](Snapshot &s){ applyDirectoryMove(s, origin, destination); });
+    printSnapshot();
+}
+
+void PathMapDB::addUnlink(std::string path)
+{
+    publish([&](Snapshot &s){ applyUnlink(s, path); });
     printSnapshot();
 }
 
-bool PathMapDB::hasMapping(std::string path)
+bool PathMapDB::hasMapping(std::string path) const
 {
     iointercept(path);
-    return snapshot.count(path);
+    PMEntry buffer;
+    return std::atomic_load(&current)->find(path, buffer) != nullptr;
 }
 
 void PathMapDB::printSnapshot() const
@@ -344,8 +530,9 @@ void PathMapDB::printSnapshot() const
         return "INVALID";
     };
     std::cout << "[----------------------------------------]" << std::endl;
-    for (auto& element : snapshot)
-        std::cout << "  " << std::setw(10) << std::left << element.first << " -> " << std::setw(10) << std::left << element.second.target << " ["
-                << typeToString(element.second.type) << "," << element.second.permissionTimeStamp << "]" << std::endl;
+    std::atomic_load(&current)->forEach([&typeToString](const std::string &origin, const PMEntry &e){
+        std::cout << "  " << std::setw(10) << std::left << origin << " -> " << std::setw(10) << std::left << e.target << " ["
+                << typeToString(e.type) << "," << e.permissionTimeStamp << "]" << std::endl;
+    });
     std::cout << "[----------------------------------------]" << std::endl;
 }
@@ -16,12 +16,15 @@
  */
 #ifndef PATHMAPDB_H
 #define PATHMAPDB_H
-#include <unordered_map>
-#include <atomic>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <list>
+#include <vector>
+#include <functional>
 #include "database.pb.h"
+#include "path_trie.h"
+#include "snapshot_file.h"
 
 /* There are slight differences in handling path mapping depending on if a terminating symbolic link should
  * be followed (open) or not (readlink). */
@@ -33,24 +36,42 @@ enum class CallingType
 class PathMapDB final
 {
     private:
-        struct PMEntry
+        /* Mappings of a snapshot loaded from a local snapshot file stay in the memory mapped file, changes applied
+         * since are kept in a trie on top of it. Without a file all mappings are kept in the trie. */
+        struct Snapshot
         {
-            hflat::MappingType    type;
-            std::string             target;
-            std::int64_t            permissionTimeStamp;
-        };
+            std::int64_t                        version;
+            std::shared_ptr<const SnapshotFile> base;       // may be null
+            PathTrie                            mappings;   // overrides base, including removed entries
+            std::size_t                         size;       // number of mappings
+
+            /* Returns the mapping of key, mappings from the base are stored in buffer. */
+            const PMEntry *find(const std::string &key, PMEntry &buffer) const;
+            void set(const std::string &key, const PMEntry &entry);
+            void erase(const std::string &key);
+            void forEach(const std::function<void(const std::string&, const PMEntry&)> &fn) const;
 
-        /* Version & hashmap of current snapshot */
-        std::int64_t snapshotVersion;
-        std::unordered_map<std::string, PMEntry> snapshot;
+            template<typename Applies>
+            const PMEntry *longestPrefix(const std::string &path, std::size_t &prefix, std::int64_t &timeStamp, Applies applies, PMEntry &buffer) const;
+        };
 
-        /* Synchronization: Ensure nobody is reading while the snapshot is being updated. */
-        mutable std::atomic<int> currentReaders;
-        mutable std::mutex lock;
+        /* Synchronization: Published snapshots are never modified. Readers obtain the current snapshot with
+         * std::atomic_load and never block. Writers are serialized by lock, apply their changes to a copy of
+         * the current snapshot (sharing all unchanged trie nodes) and publish it with std::atomic_store. */
+        std::shared_ptr<const Snapshot> current;
+        std::mutex lock;
+        std::mutex file_lock;   // serializes saveSnapshotFile()
 
     private:
         void iointercept(std::string &path) const;
-        bool searchPathRecursive(std::string& path, std::int64_t &maxTimeStamp, const bool afterMove, const bool followSymlink) const;
+        static const PMEntry *searchPath(const Snapshot &s, const std::string &path, std::size_t &prefix, std::int64_t &maxTimeStamp, bool followReuse, bool followSymlink, PMEntry &buffer);
+
+        template<typename Update>
+        void publish(Update update);
+        void applyDirectoryMove(Snapshot &s, std::string origin, std::string destination) const;
+        void applySoftLink(Snapshot &s, std::string origin, std::string destination) const;
+        void applyPermissionChange(Snapshot &s, std::string path) const;
+        void applyUnlink(Snapshot &s, std::string path) const;
 
     public:
         explicit PathMapDB();
@@ -61,17 +82,32 @@ class PathMapDB final
     public:
         /* Remaps supplied path according to current database snapshot. 
          * userPath -> systemPath
-         * minimal required path permission timestamp value is stored in supplied integer. */
-        std::string toSystemPath(const char * user_path, std::int64_t &permissionTimeStamp, CallingType ctype) const;
+         * minimal required path permission timestamp value is stored in supplied integer. The supplied
+         * system path string is used as the working buffer, its capacity is reused between calls. */
+        void toSystemPath(const char * user_path, std::string &systemPath, std::int64_t &permissionTimeStamp, CallingType ctype) const;
 
-        /* Return current database snapshot version */
+        /* Return current database snapshot version and number of mappings */
         std::int64_t getSnapshotVersion() const;
+        std::size_t getSnapshotSize() const;
+
+        /* Serialize the current snapshot into db_snapshot chunks of about chunkBytes serialized size so it can be stored in
+         * remote storage. store is called for each chunk, serialization stops if it returns an error. Returns the number of
+         * chunks or a negative error code, the serialized snapshot version is stored in version. */
+        int serializeSnapshot(std::size_t chunkBytes, std::int64_t &version, const std::function<int(const hflat::db_snapshot &chunk)> &store) const;
+
+        /* Load a snapshot from the supplied chunks. Current in-memory snapshot will be overwritten if it is older. */
+        int loadSnapshot(std::int64_t version, const std::vector<hflat::db_snapshot> &chunks);
+
+        /* Load a snapshot stored by saveSnapshotFile(). The file is memory mapped and used in place, current in-memory
+         * snapshot will be overwritten if it is older. Returns 0 or a negative error code. */
+        int loadSnapshotFile(const std::string &filename);
 
-        /* Serialize the current snapshot version into a db_snapshot protobuf structure so it can be stored in remote storage. */
-        hflat::db_snapshot serializeSnapshot();
+        /* Store the current snapshot in a local file and continue using it from there. Returns 0 or a negative
+         * error code. */
+        int saveSnapshotFile(const std::string &filename);
 
-        /* Load a the supplied database snapshot. Current in-memory snapshot will be overwritten. */
-        int loadSnapshot(const hflat::db_snapshot & snap);
+        /* Drop all mappings and reset the snapshot version to 0. */
+        void clear();
 
         /* Update the current database snapshot to given version using the supplied list of new entries.
          * Returns 0 on success or a negative error code */
@@ -85,7 +121,7 @@ class PathMapDB final
         void addUnlink(std::string path);
 
         /* Used to decide if a mapping has to be removed when a directory or link is deleted. */
-        bool hasMapping(std::string path);
+        bool hasMapping(std::string path) const;
 
         /* DEBUG ONLY */
         void printSnapshot() const;
@@ -0,0 +1,89 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "main.h"
+#include "debug.h"
+
+PathMapRefresher::PathMapRefresher(std::uint64_t interval_milliseconds) :
+        interval(interval_milliseconds), started(0), finished(0), running(false), result(0),
+        shutdown(false), refresher(), lock(), changed()
+{
+}
+
+PathMapRefresher::~PathMapRefresher()
+{
+    stop();
+}
+
+int PathMapRefresher::update(const std::function<int()> &fn)
+{
+    std::unique_lock<std::mutex> locker(lock);
+
+    /* An update that is already running might have missed changes made before this call. */
+    std::uint64_t required = started + 1;
+    while (finished < required) {
+        if (running) {
+            changed.wait(locker);
+            continue;
+        }
+        running = true;
+        started++;
+        locker.unlock();
+        int err = fn();
+        locker.lock();
+        running = false;
+        finished = started;
+        result = err;
+        changed.notify_all();
+    }
+    return result;
+}
+
+void PathMapRefresher::start(struct hflat_priv *priv, const std::function<int()> &fn)
+{
+    if (interval.count() == 0)
+        return;
+
+    refresher = std::thread([this, priv, fn](){
+        struct fuse_context context;
+        memset(&context, 0, sizeof(context));
+        context.private_data = priv;
+        hflat_set_context(&context);
+
+        std::unique_lock<std::mutex> locker(lock);
+        while (!shutdown) {
+            if (changed.wait_for(locker, interval, [this](){ return shutdown; }))
+                break;
+            locker.unlock();
+            int err = update(fn);
+            if (err && err != -EALREADY)
+                hflat_debug("background refresh of the path map failed: %d", err);
+            locker.lock();
+        }
+        hflat_set_context(nullptr);
+    });
+}
+
+void PathMapRefresher::stop()
+{
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        shutdown = true;
+        changed.notify_all();
+    }
+    if (refresher.joinable())
+        refresher.join();
+}
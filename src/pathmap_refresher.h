@@ -0,0 +1,65 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PATHMAP_REFRESHER_H_
+#define PATHMAP_REFRESHER_H_
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+
+struct hflat_priv;
+
+/* Keeps the local path map snapshot up to date with the remote database log.
+ *
+ * Updates are serialized and coalesced: a caller waits for an update that started after its call, concurrent
+ * callers share the same update. If an interval is configured, a background thread polls the remote database
+ * version and applies new entries off the request path, so that foreground operations rarely have to wait. */
+class PathMapRefresher final
+{
+private:
+    std::chrono::milliseconds interval;
+
+    std::uint64_t   started;    // number of updates started
+    std::uint64_t   finished;   // number of updates finished
+    bool            running;
+    int             result;     // result of the last finished update
+
+    bool                    shutdown;
+    std::thread             refresher;
+    std::mutex              lock;
+    std::condition_variable changed;
+
+public:
+    /* Run fn or wait for a concurrent caller running it. Returns the result of an update that started
+     * after this call. */
+    int update(const std::function<int()> &fn);
+
+    /* Start polling the remote database in the background, unless the interval is 0. */
+    void start(struct hflat_priv *priv, const std::function<int()> &fn);
+    void stop();
+
+public:
+    /* Set interval to 0 to disable background refreshing. */
+    explicit PathMapRefresher(std::uint64_t interval_milliseconds);
+    ~PathMapRefresher();
+    PathMapRefresher(const PathMapRefresher& rhs) = delete;
+    PathMapRefresher& operator=(const PathMapRefresher& rhs) = delete;
+};
+
+#endif /* PATHMAP_REFRESHER_H_ */
@@ -0,0 +1,154 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "main.h"
+#include "debug.h"
+
+namespace {
+/* Number of directories scanned concurrently. */
+const int worker_count = 4;
+}
+
+PermissionVerifier::PermissionVerifier(int inodes_per_second) :
+        interval(inodes_per_second > 0 ?
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::seconds(1)) / inodes_per_second :
+                std::chrono::steady_clock::duration::zero()),
+        next(), pending(), scanned(), generation(0), active(0), shutdown(false), workers(), lock(), changed()
+{
+}
+
+PermissionVerifier::~PermissionVerifier()
+{
+    stop();
+}
+
+bool PermissionVerifier::throttle()
+{
+    std::unique_lock<std::mutex> locker(lock);
+    auto now = std::chrono::steady_clock::now();
+    if (next < now)
+        next = now;
+    auto slot = next;
+    next += interval;
+    return !changed.wait_until(locker, slot, [this](){ return shutdown; });
+}
+
+void PermissionVerifier::scan(const Directory &directory)
+{
+    /* The directory itself has usually just been verified as a child of its parent. */
+    std::shared_ptr<MetadataInfo> mdi;
+    if (int err = lookup(directory.path.c_str(), mdi)) {
+        hflat_debug("skipping path permission verification below %s: %d", directory.path.c_str(), err);
+        return;
+    }
+    if (!S_ISDIR(mdi->getMD().mode()))
+        return;
+
+    /* Symbolic links can lead to a directory multiple times. */
+    std::uint64_t inode_number = mdi->getMD().inode_number();
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        std::uint64_t &latest = scanned[inode_number];
+        if (latest >= directory.generation)
+            return;
+        latest = directory.generation;
+    }
+
+    std::string prefix = directory.path == "/" ? directory.path : directory.path + "/";
+    string keystart = std::to_string(inode_number) + "|";
+    string keyend   = std::to_string(inode_number) + "|" + static_cast<char>(251);
+    size_t maxsize = 100;
+    unique_ptr<vector<std::string>> keys(new vector<string>());
+
+    do {
+        if (keys->size())
+            keystart = keys->back();
+        keys->clear();
+        KineticStatus status = PRIV->kinetic->GetKeyRange(keystart, keyend, maxsize, keys);
+        if (!status.ok()) {
+            hflat_warning("Failed listing directory %s: %s", directory.path.c_str(), status.message().c_str());
+            return;
+        }
+        for (auto& element : *keys) {
+            if (!throttle())
+                return;
+
+            /* A lookup updates stale path permissions from the (already verified) parent directory. */
+            std::string path = prefix + element.substr(element.find_first_of('|') + 1);
+            std::shared_ptr<MetadataInfo> child;
+            if (int err = lookup(path.c_str(), child)) {
+                hflat_debug("path permission verification of %s failed: %d", path.c_str(), err);
+                continue;
+            }
+            if (S_ISDIR(child->getMD().mode())) {
+                std::lock_guard<std::mutex> locker(lock);
+                pending.push_back(Directory{path, directory.generation});
+                changed.notify_all();
+            }
+        }
+    } while (keys->size() == maxsize);
+}
+
+void PermissionVerifier::schedule(const std::string &user_path)
+{
+    std::lock_guard<std::mutex> locker(lock);
+    if (workers.empty() || shutdown)
+        return;
+    pending.push_back(Directory{user_path, ++generation});
+    changed.notify_all();
+}
+
+void PermissionVerifier::start(struct hflat_priv *priv)
+{
+    if (interval == std::chrono::steady_clock::duration::zero())
+        return;
+
+    for (int i = 0; i < worker_count; i++)
+        workers.push_back(std::thread([this, priv](){
+            struct fuse_context context;
+            memset(&context, 0, sizeof(context));
+            context.private_data = priv;
+            hflat_set_context(&context);
+
+            std::unique_lock<std::mutex> locker(lock);
+            while (!shutdown) {
+                changed.wait(locker, [this](){ return shutdown || !pending.empty(); });
+                if (shutdown)
+                    break;
+                Directory directory = std::move(pending.front());
+                pending.pop_front();
+                active++;
+                locker.unlock();
+                scan(directory);
+                locker.lock();
+                if (--active == 0 && pending.empty())
+                    scanned.clear();
+            }
+            hflat_set_context(nullptr);
+        }));
+}
+
+void PermissionVerifier::stop()
+{
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        shutdown = true;
+        changed.notify_all();
+    }
+    for (auto &w : workers)
+        if (w.joinable())
+            w.join();
+}
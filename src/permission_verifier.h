@@ -0,0 +1,80 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PERMISSION_VERIFIER_H_
+#define PERMISSION_VERIFIER_H_
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <string>
+#include <cstdint>
+
+struct hflat_priv;
+
+/* Re-verifies path permissions below a directory whose permissions changed.
+ *
+ * A permission change of a directory makes the path permissions of everything below it stale, each inode would
+ * otherwise be updated by the first lookup accessing it. Background threads walk the directory entries of the
+ * subtree breadth-first and look up every inode, which updates stale path permissions off the request path. The
+ * walk is throttled to a configured number of inodes per second to limit the load on the drives. */
+class PermissionVerifier final
+{
+private:
+    struct Directory
+    {
+        std::string     path;
+        std::uint64_t   generation; // of the subtree walk the directory belongs to
+    };
+
+    std::chrono::steady_clock::duration     interval;   // between two inodes verified
+    std::chrono::steady_clock::time_point   next;       // earliest time the next inode may be verified
+
+    std::deque<Directory>   pending;    // directories left to scan
+    std::unordered_map<std::uint64_t, std::uint64_t> scanned;  // inode number -> latest generation scanned
+    std::uint64_t           generation; // number of subtree walks scheduled
+    std::size_t             active;     // directories currently scanned
+
+    bool                     shutdown;
+    std::vector<std::thread> workers;
+    std::mutex               lock;
+    std::condition_variable  changed;
+
+private:
+    /* Wait for the next slot permitted by the configured rate. Returns false on shutdown. */
+    bool throttle();
+    void scan(const Directory &directory);
+
+public:
+    /* Re-verify path permissions of everything below the supplied directory. Does nothing if not started. */
+    void schedule(const std::string &user_path);
+
+    /* Start the background threads, unless the rate is 0. */
+    void start(struct hflat_priv *priv);
+    void stop();
+
+public:
+    /* Set rate to 0 to disable background re-verification. */
+    explicit PermissionVerifier(int inodes_per_second);
+    ~PermissionVerifier();
+    PermissionVerifier(const PermissionVerifier& rhs) = delete;
+    PermissionVerifier& operator=(const PermissionVerifier& rhs) = delete;
+};
+
+#endif /* PERMISSION_VERIFIER_H_ */
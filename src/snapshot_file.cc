@@ -0,0 +1,337 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "snapshot_file.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <algorithm>
+#include <cassert>
+
+namespace {
+struct Header
+{
+    char            magic[8];
+    std::int64_t    version;
+    std::uint64_t   count;
+    std::uint64_t   restarts;
+    std::uint64_t   index;      // offset of the restart index
+};
+const char magic[8] = "HFPMAP1";
+
+/* Every restart_interval-th key is stored in full. */
+const std::uint64_t restart_interval = 16;
+
+struct Record
+{
+    std::uint64_t   shared;
+    const char     *key;        // key bytes following the shared prefix
+    std::uint64_t   unshared;
+    std::uint8_t    type;
+    const char     *target;
+    std::uint64_t   target_length;
+    std::int64_t    timestamp;
+};
+
+void put_varint(std::string &buffer, std::uint64_t value)
+{
+    while (value >= 0x80) {
+        buffer.push_back((char) (value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back((char) value);
+}
+
+bool get_varint(const char *&pos, const char *end, std::uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+        std::uint8_t byte = *pos++;
+        value |= (std::uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+/* Decode the record at pos and advance pos past it. Returns false if the record exceeds end. */
+bool decode(const char *&pos, const char *end, Record &r)
+{
+    std::uint64_t timestamp;
+    if (!get_varint(pos, end, r.shared) || !get_varint(pos, end, r.unshared) || r.unshared > (std::uint64_t) (end - pos))
+        return false;
+    r.key = pos;
+    pos += r.unshared;
+    if (pos == end)
+        return false;
+    r.type = *pos++;
+    if (!get_varint(pos, end, r.target_length) || r.target_length > (std::uint64_t) (end - pos))
+        return false;
+    r.target = pos;
+    pos += r.target_length;
+    if (!get_varint(pos, end, timestamp))
+        return false;
+    r.timestamp = (std::int64_t) (timestamp >> 1) ^ -(std::int64_t) (timestamp & 1);
+    return true;
+}
+
+void to_entry(const Record &r, PMEntry &entry)
+{
+    entry.type = (hflat::MappingType) r.type;
+    entry.target.assign(r.target, r.target_length);
+    entry.permissionTimeStamp = r.timestamp;
+}
+}
+
+int SnapshotFile::compare(const char *a, std::size_t alength, const char *b, std::size_t blength)
+{
+    /* A '/' ends a component and sorts before every character that continues it. */
+    for (std::size_t i = 0; i < std::min(alength, blength); i++) {
+        std::uint8_t ca = a[i] == '/' ? 0 : a[i];
+        std::uint8_t cb = b[i] == '/' ? 0 : b[i];
+        if (ca != cb)
+            return ca < cb ? -1 : 1;
+    }
+    return alength < blength ? -1 : alength > blength ? 1 : 0;
+}
+
+SnapshotFile::Writer::Writer() :
+        buffer(sizeof(Header), '\0'), restarts(), last(), count(0)
+{
+}
+
+SnapshotFile::Writer::~Writer()
+{
+}
+
+void SnapshotFile::Writer::add(const std::string &key, const PMEntry &entry)
+{
+    assert(count == 0 || compare(last.data(), last.size(), key.data(), key.size()) < 0);
+
+    std::size_t shared = 0;
+    if (count % restart_interval == 0)
+        restarts.push_back(buffer.size());
+    else
+        while (shared < std::min(last.size(), key.size()) && last[shared] == key[shared])
+            shared++;
+
+    put_varint(buffer, shared);
+    put_varint(buffer, key.size() - shared);
+    buffer.append(key, shared, std::string::npos);
+    buffer.push_back((char) entry.type);
+    put_varint(buffer, entry.target.size());
+    buffer.append(entry.target);
+    put_varint(buffer, ((std::uint64_t) entry.permissionTimeStamp << 1) ^ (std::uint64_t) (entry.permissionTimeStamp >> 63));
+
+    last = key;
+    count++;
+}
+
+int SnapshotFile::Writer::write(const std::string &filename, std::int64_t version)
+{
+    /* The restart index is read in place and has to be aligned. */
+    buffer.resize((buffer.size() + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t) * sizeof(std::uint64_t), '\0');
+
+    Header h;
+    memcpy(h.magic, magic, sizeof(magic));
+    h.version  = version;
+    h.count    = count;
+    h.restarts = restarts.size();
+    h.index    = buffer.size();
+    memcpy(&buffer[0], &h, sizeof(h));
+    buffer.append((const char *) restarts.data(), restarts.size() * sizeof(std::uint64_t));
+
+    std::string tmp = filename + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return -errno;
+
+    int err = 0;
+    for (std::size_t written = 0; written < buffer.size() && !err; ) {
+        ssize_t rtn = ::write(fd, buffer.data() + written, buffer.size() - written);
+        if (rtn < 0 && errno != EINTR)
+            err = -errno;
+        if (rtn > 0)
+            written += rtn;
+    }
+    if (!err && fsync(fd))
+        err = -errno;
+    if (close(fd) && !err)
+        err = -errno;
+    if (!err && rename(tmp.c_str(), filename.c_str()))
+        err = -errno;
+    if (err)
+        unlink(tmp.c_str());
+    return err;
+}
+
+SnapshotFile::SnapshotFile(const char *mapping, std::size_t mapping_bytes) :
+        data(mapping), bytes(mapping_bytes), snapshot_version(0), count(0), restarts(nullptr), restart_count(0)
+{
+    const Header *h = (const Header *) data;
+    snapshot_version = h->version;
+    count = h->count;
+    restart_count = h->restarts;
+    if (h->index <= bytes && h->index % sizeof(std::uint64_t) == 0)
+        restarts = (const std::uint64_t *) (data + h->index);
+}
+
+SnapshotFile::~SnapshotFile()
+{
+    munmap((void *) data, bytes);
+}
+
+std::shared_ptr<const SnapshotFile> SnapshotFile::open(const std::string &filename, int &err)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        err = -errno;
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        err = -errno;
+        close(fd);
+        return nullptr;
+    }
+    if ((std::size_t) st.st_size < sizeof(Header)) {
+        err = -EINVAL;
+        close(fd);
+        return nullptr;
+    }
+
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        err = -errno;
+        return nullptr;
+    }
+
+    std::shared_ptr<const SnapshotFile> file(new SnapshotFile((const char *) data, st.st_size));
+    if (!file->validate()) {
+        err = -EINVAL;
+        return nullptr;
+    }
+    err = 0;
+    return file;
+}
+
+/* A corrupted file must not lead to reads outside of the mapping, so every record is checked once when the file
+ * is opened. This is a single sequential pass over the mapped file without allocations per record. */
+bool SnapshotFile::validate() const
+{
+    const Header *h = (const Header *) data;
+    if (memcmp(h->magic, magic, sizeof(magic)) || !restarts ||
+        restart_count != (count + restart_interval - 1) / restart_interval ||
+        restart_count > (bytes - h->index) / sizeof(std::uint64_t))
+        return false;
+
+    const char *pos = data + sizeof(Header);
+    const char *end = data + h->index;
+    std::string key, previous;
+    for (std::uint64_t i = 0; i < count; i++) {
+        bool restart = i % restart_interval == 0;
+        if (restart && restarts[i / restart_interval] != (std::uint64_t) (pos - data))
+            return false;
+
+        Record r;
+        if (!decode(pos, end, r) || r.shared > key.size() || (restart && r.shared) || !hflat::MappingType_IsValid(r.type))
+            return false;
+        key.swap(previous);
+        key.assign(previous, 0, r.shared);
+        key.append(r.key, r.unshared);
+        if (i && compare(previous.data(), previous.size(), key.data(), key.size()) >= 0)
+            return false;
+    }
+    return true;
+}
+
+std::int64_t SnapshotFile::version() const
+{
+    return snapshot_version;
+}
+
+std::size_t SnapshotFile::size() const
+{
+    return count;
+}
+
+/* Index of the last restart with a key not greater than the supplied key, 0 if there is none. */
+std::size_t SnapshotFile::restartBefore(const char *key, std::size_t length) const
+{
+    std::size_t low = 0, high = restart_count;
+    while (high - low > 1) {
+        std::size_t mid = low + (high - low) / 2;
+        const char *pos = data + restarts[mid];
+        Record r;
+        decode(pos, data + bytes, r);
+        if (compare(r.key, r.unshared, key, length) <= 0)
+            low = mid;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+bool SnapshotFile::find(const char *key, std::size_t length, PMEntry &entry, bool &descendants) const
+{
+    bool found = false;
+    descendants = false;
+    if (!count)
+        return found;
+
+    /* Keys starting with key + '/' directly follow key in PathTrie order. */
+    thread_local std::string current;
+    const char *pos = data + restarts[restartBefore(key, length)];
+    const char *end = data + ((const Header *) data)->index;
+    while (pos < end) {
+        Record r;
+        decode(pos, end, r);
+        current.resize(r.shared);
+        current.append(r.key, r.unshared);
+
+        int c = compare(current.data(), current.size(), key, length);
+        if (c < 0)
+            continue;
+        if (c == 0) {
+            to_entry(r, entry);
+            found = true;
+            continue;
+        }
+        descendants = current.size() > length && current[length] == '/' && !current.compare(0, length, key, length);
+        break;
+    }
+    return found;
+}
+
+void SnapshotFile::forEach(const std::function<void(const std::string&, const PMEntry&)> &fn) const
+{
+    const char *pos = data + sizeof(Header);
+    const char *end = data + ((const Header *) data)->index;
+    std::string key;
+    PMEntry entry;
+    for (std::uint64_t i = 0; i < count; i++) {
+        Record r;
+        decode(pos, end, r);
+        key.resize(r.shared);
+        key.append(r.key, r.unshared);
+        to_entry(r, entry);
+        fn(key, entry);
+    }
+}
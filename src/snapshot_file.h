@@ -0,0 +1,99 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SNAPSHOT_FILE_H_
+#define SNAPSHOT_FILE_H_
+#include "path_trie.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+/* Compact, read-only path map snapshot stored in a local file.
+ *
+ * Keys are stored in PathTrie order (component by component), every key shares a prefix with its predecessor that
+ * is not stored again. Every restart_interval-th key is stored in full and indexed, so a key is found by a binary
+ * search over the index followed by a short scan. The file is memory mapped and used in place: opening a snapshot
+ * doesn't allocate per mapping and only touches the pages that are actually used.
+ *
+ * Layout (native byte order, the file is a local cache and never shared between hosts):
+ *   header   magic, snapshot version, number of mappings, number of restarts, index offset
+ *   records  varint shared, varint unshared, key bytes, type, varint target length, target bytes, varint timestamp
+ *   index    uint64 offset of every restart record */
+class SnapshotFile final
+{
+public:
+    /* Builds a snapshot file in memory, keys have to be added in PathTrie order. */
+    class Writer final
+    {
+    private:
+        std::string             buffer;
+        std::vector<std::uint64_t> restarts;
+        std::string             last;
+        std::uint64_t           count;
+
+    public:
+        void add(const std::string &key, const PMEntry &entry);
+
+        /* Write the snapshot to a temporary file that replaces filename once complete, readers that mapped
+         * the previous file are not affected. Returns 0 or a negative error code. */
+        int write(const std::string &filename, std::int64_t version);
+
+    public:
+        explicit Writer();
+        ~Writer();
+    };
+
+private:
+    const char     *data;
+    std::size_t     bytes;
+    std::int64_t    snapshot_version;
+    std::uint64_t   count;
+    const std::uint64_t *restarts;
+    std::uint64_t   restart_count;
+
+private:
+    bool validate() const;
+    std::size_t restartBefore(const char *key, std::size_t length) const;
+
+public:
+    /* Map the supplied file. Returns nullptr and sets err if the file is missing or not a valid snapshot. */
+    static std::shared_ptr<const SnapshotFile> open(const std::string &filename, int &err);
+
+    std::int64_t version() const;
+    std::size_t size() const;
+
+    /* Looks up key. If it is mapped the mapping is stored in entry and true is returned. descendants is set if a
+     * key starting with key followed by a '/' exists. */
+    bool find(const char *key, std::size_t length, PMEntry &entry, bool &descendants) const;
+
+    /* Calls fn for every key / mapping pair, in key order. */
+    void forEach(const std::function<void(const std::string&, const PMEntry&)> &fn) const;
+
+    /* Compare keys in PathTrie order: component by component. */
+    static int compare(const char *a, std::size_t alength, const char *b, std::size_t blength);
+
+public:
+    ~SnapshotFile();
+    SnapshotFile(const SnapshotFile& rhs) = delete;
+    SnapshotFile& operator=(const SnapshotFile& rhs) = delete;
+
+private:
+    explicit SnapshotFile(const char *mapping, std::size_t mapping_bytes);
+};
+
+#endif /* SNAPSHOT_FILE_H_ */
@@ -20,10 +20,12 @@
 #include "database.pb.h"
 #include <stdint.h>
 #include <uuid/uuid.h>
-#include <future>
 
 using com::seagate::kinetic::client::proto::Command_Algorithm_SHA1;
 
+/* Checkpoint chunks stay well below the maximum value size. */
+static const std::size_t checkpoint_chunk_bytes = 512 * 1024;
+
 namespace util
 {
 
@@ -51,39 +53,50 @@ std::string generate_uuid()
     return std::string(reinterpret_cast<const char *>(uuid), sizeof(uuid_t));
 }
 
-int grab_inode_generation_token(void)
+/* Key versions consist of a prefix chosen randomly at mount time followed by a big endian per-client counter.
+ * They are as long as a uuid and unique with the same probability, but don't consult the random number
+ * generator for each write. Versions written by the same client sort by age. */
+std::string generate_version(void)
+{
+    std::uint64_t counter = ++PRIV->version_counter;
+    std::string version(PRIV->version_prefix);
+    for (int shift = 56; shift >= 0; shift -= 8)
+        version.push_back(static_cast<char>(counter >> shift));
+    return version;
+}
+
+/* The version of the inode_generation key is the first number that has not been claimed yet. */
+int claim_inode_numbers(std::uint64_t count, std::uint64_t &base)
 {
     const std::string inode_base_key = "inode_generation";
 
-    std::unique_ptr<std::string> keyVersion;
-    KineticStatus status = PRIV->kinetic->GetVersion(inode_base_key, keyVersion);
-    if (status.ok())
-        PRIV->inum_base = util::to_int64(keyVersion->data());
-    else if (status.statusCode() == kinetic::StatusCode::REMOTE_NOT_FOUND)
-        PRIV->inum_base = 0;
-    else
-        return -EIO;
-
-    KineticRecord empty("", std::to_string(PRIV->inum_base + std::numeric_limits<std::uint16_t>::max()), "", Command_Algorithm_SHA1);
-    status = PRIV->kinetic->Put(inode_base_key, PRIV->inum_base ? std::to_string(PRIV->inum_base) : "", WriteMode::REQUIRE_SAME_VERSION, empty);
-    if (status.statusCode() ==  kinetic::StatusCode::REMOTE_VERSION_MISMATCH)
-        return grab_inode_generation_token();
-    if (!status.ok())
-        return -EIO;
-    return 0;
+    for (;;) {
+        std::unique_ptr<std::string> keyVersion;
+        KineticStatus status = PRIV->kinetic->GetVersion(inode_base_key, keyVersion);
+        if (status.ok())
+            base = util::to_int64(keyVersion->data());
+        else if (status.statusCode() == kinetic::StatusCode::REMOTE_NOT_FOUND)
+            base = 0;
+        else
+            return -EIO;
+
+        KineticRecord empty("", std::to_string(base + count), "", Command_Algorithm_SHA1);
+        status = PRIV->kinetic->Put(inode_base_key, base ? std::to_string(base) : "", WriteMode::REQUIRE_SAME_VERSION, empty);
+        if (status.statusCode() ==  kinetic::StatusCode::REMOTE_VERSION_MISMATCH)
+            continue;
+        if (!status.ok())
+            return -EIO;
+        return 0;
+    }
 }
 
 ino_t generate_inode_number(void)
 {
-    std::lock_guard<std::mutex> locker(PRIV->lock);
-    PRIV->inum_counter++;
-    if (PRIV->inum_counter == std::numeric_limits<std::uint16_t>::max()){
-       if( grab_inode_generation_token() )
-           hflat_error(" Error encountered when attempting to refresh inode generation token. "
-                     " Cannot generate inode numbers. Quitting. ");
-       PRIV->inum_counter = 0;
-    }
-    return (ino_t) (PRIV->inum_base +  PRIV->inum_counter);
+    std::uint64_t number = 0;
+    if (PRIV->inodes.allocate(number))
+        hflat_error(" Error encountered when attempting to claim inode numbers. "
+                  " Cannot generate inode numbers. Quitting. ");
+    return (ino_t) number;
 }
 
 std::string path_to_filename(const std::string &path)
@@ -91,9 +104,182 @@ std::string path_to_filename(const std::string &path)
     return path.substr(path.find_last_of("/:") + 1);
 }
 
+/* Serialization reuses a buffer of the calling thread. The record shares the buffer instead of copying the
+ * serialized message, the buffer is only replaced if a record still refers to it on the next call. */
+KineticRecord serialized_record(const google::protobuf::Message &msg, const std::string &version)
+{
+    thread_local std::shared_ptr<std::string> buffer;
+    if (!buffer || buffer.use_count() != 1)
+        buffer = std::make_shared<std::string>();
+    msg.SerializeToString(buffer.get());
+    return KineticRecord(buffer, std::make_shared<const std::string>(version), std::make_shared<const std::string>(), Command_Algorithm_SHA1);
+}
+
+/* Apply db_entries (fromVersion, toVersion] to the local snapshot. */
+static int database_apply(const std::list<hflat::db_entry> &entries, std::int64_t fromVersion, std::int64_t toVersion)
+{
+    int err = PRIV->pmap.updateSnapshot(entries, fromVersion, toVersion);
+
+    /* Paths changed by other clients might be cached by the kernel. */
+    if (!err && PRIV->invalidate_entry)
+        for (auto &e : entries) {
+            PRIV->invalidate_entry(e.origin());
+            if (e.type() == hflat::db_entry_Type_MOVE)
+                PRIV->invalidate_entry(e.target());
+        }
+    return err;
+}
+
+/* Obtain db_entries (snapshotVersion, dbVersion] and apply them to the local snapshot. Up to the configured window
+ * of entries is requested concurrently, every contiguous prefix of fetched entries is applied as soon as it is
+ * complete. If an entry cannot be obtained, the entries preceding it are still applied. */
+static int database_fetch(std::int64_t snapshotVersion, std::int64_t dbVersion)
+{
+    struct Slot
+    {
+        hflat::db_entry entry;
+        bool            done;
+    };
+    std::vector<Slot> slots(dbVersion - snapshotVersion);
+    std::size_t applied = 0;
+    bool applying = false;
+    int apply_err = 0;
+    std::mutex lock;
+
+    return PRIV->workers.run(slots.size(), PRIV->options.pathmap_fetch_window, [&](std::size_t i){
+        hflat::db_entry entry;
+        int err = get_db_entry(snapshotVersion + 1 + i, entry);
+        if (err)
+            return err;
+
+        /* The thread completing the next entry to be applied applies every contiguous entry fetched so far,
+         * including entries completed by other threads while it is applying. */
+        std::unique_lock<std::mutex> locker(lock);
+        slots[i].entry.Swap(&entry);
+        slots[i].done = true;
+        while (!applying && !apply_err && applied < slots.size() && slots[applied].done) {
+            std::list<hflat::db_entry> entries;
+            std::size_t end = applied;
+            for (; end < slots.size() && slots[end].done; end++) {
+                entries.push_back(hflat::db_entry());
+                entries.back().Swap(&slots[end].entry);
+            }
+            applying = true;
+            locker.unlock();
+            int aerr = database_apply(entries, snapshotVersion + applied, snapshotVersion + end);
+            locker.lock();
+            applying = false;
+            applied = end;
+            apply_err = aerr;
+        }
+        return apply_err;
+    });
+}
+
+/* Number of db_entries between checkpoints. Writing a checkpoint costs about as much as replaying a number of
+ * db_entries proportional to the snapshot size. Growing the interval with the snapshot keeps the checkpoint
+ * cost per db_entry constant. */
+static std::int64_t checkpoint_interval(void)
+{
+    return std::max<std::int64_t>({1, PRIV->options.pathmap_checkpoint_interval, (std::int64_t) PRIV->pmap.getSnapshotSize() / 4});
+}
+
+/* Load the checkpoint described by the supplied manifest, chunks are obtained in parallel. */
+static int database_load_checkpoint(const hflat::db_checkpoint &c)
+{
+    std::vector<hflat::db_snapshot> chunks(c.chunks());
+    int err = PRIV->workers.run(chunks.size(), PRIV->options.pathmap_fetch_window, [&](std::size_t i){
+        return get_db_checkpoint_chunk(c.snapshot_version(), i, chunks[i]);
+    });
+    if (err) {
+        hflat_warning("Failed loading checkpoint of database version %ld: %d", c.snapshot_version(), err);
+        return err;
+    }
+    return PRIV->pmap.loadSnapshot(c.snapshot_version(), chunks);
+}
+
+/* Write a checkpoint of the current snapshot. The snapshot is immutable, so it is serialized and stored in the
+ * background. Concurrent checkpoints of other clients are resolved using the manifest version: the chunks of the
+ * checkpoint that is not referenced by the manifest are removed. */
+static void database_checkpoint(void)
+{
+    bool running = false;
+    if (!PRIV->checkpoint_running.compare_exchange_strong(running, true))
+        return;
+
+    bool submitted = PRIV->workers.submit([](){
+        hflat::db_checkpoint previous;
+        int err = get_db_checkpoint(previous);
+        if (err == -ENOENT) {
+            previous.set_snapshot_version(0);
+            previous.set_chunks(0);
+            err = 0;
+        }
+
+        /* Another client might have written a checkpoint since the local checkpoint version has been updated. */
+        if (!err && PRIV->pmap.getSnapshotVersion() - previous.snapshot_version() < checkpoint_interval())
+            err = -EALREADY;
+
+        std::int64_t version = 0;
+        int stored = 0;
+        if (!err) {
+            int chunks = PRIV->pmap.serializeSnapshot(checkpoint_chunk_bytes, version, [&](const hflat::db_snapshot &chunk){
+                int e = put_db_checkpoint_chunk(version, stored, chunk);
+                if (!e)
+                    stored++;
+                return e;
+            });
+            if (chunks < 0)
+                err = chunks;
+        }
+
+        if (!err) {
+            hflat::db_checkpoint c;
+            c.set_snapshot_version(version);
+            c.set_chunks(stored);
+            err = put_db_checkpoint(c, previous.snapshot_version());
+        }
+
+        if (!err) {
+            delete_db_checkpoint(previous.snapshot_version(), previous.chunks());
+            PRIV->checkpoint_version = std::max(PRIV->checkpoint_version.load(), version);
+            database_store_cache();
+        } else {
+            /* Chunks of the same version are identical, don't remove chunks referenced by a concurrent checkpoint. */
+            hflat::db_checkpoint current;
+            if (stored && (get_db_checkpoint(current) || current.snapshot_version() != version))
+                delete_db_checkpoint(version, stored);
+            PRIV->checkpoint_version = std::max(PRIV->checkpoint_version.load(), previous.snapshot_version());
+            if (err != -EALREADY && err != -EAGAIN)
+                hflat_warning("Failed writing checkpoint: %d", err);
+        }
+        PRIV->checkpoint_running = false;
+    });
+    if (!submitted)
+        PRIV->checkpoint_running = false;
+}
+
+void database_load_cache(void)
+{
+    if (PRIV->options.pathmap_cache_file.empty())
+        return;
+    int err = PRIV->pmap.loadSnapshotFile(PRIV->options.pathmap_cache_file);
+    if (err && err != -ENOENT)
+        hflat_warning("Failed loading path map cache file %s: %d", PRIV->options.pathmap_cache_file.c_str(), err);
+}
+
+void database_store_cache(void)
+{
+    if (PRIV->options.pathmap_cache_file.empty())
+        return;
+    int err = PRIV->pmap.saveSnapshotFile(PRIV->options.pathmap_cache_file);
+    if (err)
+        hflat_warning("Failed storing path map cache file %s: %d", PRIV->options.pathmap_cache_file.c_str(), err);
+}
+
 /* Update the local database snapshot from remotely stored db_entries. Returns -EALREADY if
  * the local snapshot is already at the newest version. */
-int database_update(void)
+static int database_catch_up(void)
 {
     std::int64_t dbVersion;
     std::int64_t snapshotVersion = PRIV->pmap.getSnapshotVersion();
@@ -101,7 +287,17 @@ int database_update(void)
 
     if (int err = get_db_version(dbVersion))
         return err;
-    assert(dbVersion >= snapshotVersion);
+
+    /* The version key might lag behind a snapshot loaded from the local cache file, the log can not. */
+    if (dbVersion < snapshotVersion) {
+        if (get_db_entry(snapshotVersion, entry) == -ENOENT) {
+            hflat_warning("Local path map version %ld is ahead of the database, discarding it.", snapshotVersion);
+            PRIV->pmap.clear();
+            snapshotVersion = 0;
+        }
+        else
+            dbVersion = snapshotVersion;
+    }
 
     if (dbVersion == snapshotVersion){
         /* dbVersion could be outdated... make sure before failing. */
@@ -110,23 +306,36 @@ int database_update(void)
         dbVersion+=1;
     }
 
-    /* See if it makes sense to get a full snapshot instead of an incremental update. */
-    if(dbVersion - snapshotVersion > 42){
-        hflat::db_snapshot s;
-        if(get_db_snapshot(s) == 0){
-            PRIV->pmap.loadSnapshot(s);
-            snapshotVersion = PRIV->pmap.getSnapshotVersion();
+    /* See if it makes sense to load a checkpoint instead of an incremental update. The latest checkpoint
+     * version is also required to decide when to write the next checkpoint. */
+    if (PRIV->checkpoint_version < 0 || dbVersion - snapshotVersion > checkpoint_interval()) {
+        hflat::db_checkpoint c;
+        int err = get_db_checkpoint(c);
+        if (err == -ENOENT)
+            PRIV->checkpoint_version = 0;
+        if (!err) {
+            PRIV->checkpoint_version = std::max(PRIV->checkpoint_version.load(), c.snapshot_version());
+            if (c.snapshot_version() - snapshotVersion > checkpoint_interval() && database_load_checkpoint(c) == 0) {
+                snapshotVersion = PRIV->pmap.getSnapshotVersion();
+                database_store_cache();
+            }
         }
     }
 
     /* Update using single db_entries. */
-    std::list<hflat::db_entry> entries;
-    for (std::int64_t v = snapshotVersion + 1; v <= dbVersion; v++) {
-        if (int err = get_db_entry(v, entry))
-            return err;
-        entries.push_back(entry);
-    }
-    return PRIV->pmap.updateSnapshot(entries, snapshotVersion, dbVersion);
+    if (dbVersion > snapshotVersion)
+        return database_fetch(snapshotVersion, dbVersion);
+    return 0;
+}
+
+int database_update(void)
+{
+    return PRIV->pmap_refresher.update(database_catch_up);
+}
+
+void database_refresh_start(void)
+{
+    PRIV->pmap_refresher.start(PRIV, database_catch_up);
 }
 
 int database_operation(hflat::db_entry &entry)
@@ -138,10 +347,8 @@ int database_operation(hflat::db_entry &entry)
         std::list<hflat::db_entry> entries;
         entries.push_back(entry);
         PRIV->pmap.updateSnapshot(entries, snapshotVersion, snapshotVersion + 1);
-        if(snapshotVersion % 42 == 0){
-            hflat::db_snapshot s = PRIV->pmap.serializeSnapshot();
-            put_db_snapshot(s);
-        }
+        if (PRIV->checkpoint_version >= 0 && snapshotVersion + 1 - PRIV->checkpoint_version >= checkpoint_interval())
+            database_checkpoint();
         return 0;
     }
     if (  err != -EEXIST){
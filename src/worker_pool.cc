@@ -0,0 +1,122 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "main.h"
+#include "debug.h"
+#include <algorithm>
+
+WorkerPool::WorkerPool() :
+        tasks(), workers(), shutdown(false), lock(), changed()
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+void WorkerPool::start(struct hflat_priv *priv, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++)
+        workers.push_back(std::thread([this, priv](){
+            struct fuse_context context;
+            memset(&context, 0, sizeof(context));
+            context.private_data = priv;
+            hflat_set_context(&context);
+
+            std::unique_lock<std::mutex> locker(lock);
+            while (!shutdown) {
+                changed.wait(locker, [this](){ return shutdown || !tasks.empty(); });
+                if (shutdown)
+                    break;
+                std::function<void()> task = std::move(tasks.front());
+                tasks.pop_front();
+                locker.unlock();
+                task();
+                locker.lock();
+            }
+            hflat_set_context(nullptr);
+        }));
+}
+
+void WorkerPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        shutdown = true;
+        tasks.clear();
+        changed.notify_all();
+    }
+    for (auto &w : workers)
+        if (w.joinable())
+            w.join();
+}
+
+bool WorkerPool::submit(const std::function<void()> &task)
+{
+    std::lock_guard<std::mutex> locker(lock);
+    if (workers.empty() || shutdown)
+        return false;
+    tasks.push_back(task);
+    changed.notify_one();
+    return true;
+}
+
+int WorkerPool::run(std::size_t count, std::size_t window, const std::function<int(std::size_t)> &fn)
+{
+    /* Helpers that start after the caller returned find no calls left, they only touch the shared state. */
+    struct State
+    {
+        std::function<int(std::size_t)> fn;
+        std::size_t             count;
+        std::size_t             next;
+        std::size_t             running;
+        int                     err;
+        std::mutex              lock;
+        std::condition_variable finished;
+    };
+    auto state = std::make_shared<State>();
+    state->fn = fn;
+    state->count = count;
+    state->next = 0;
+    state->running = 0;
+    state->err = 0;
+
+    auto worker = [state](){
+        std::unique_lock<std::mutex> locker(state->lock);
+        state->running++;
+        while (!state->err && state->next < state->count) {
+            std::size_t i = state->next++;
+            locker.unlock();
+            int err = state->fn(i);
+            locker.lock();
+            if (err && !state->err)
+                state->err = err;
+        }
+        if (--state->running == 0)
+            state->finished.notify_all();
+    };
+
+    window = std::min(std::max<std::size_t>(window, 1), count);
+    for (std::size_t i = 1; i < window; i++)
+        if (!submit(worker))
+            break;
+    worker();
+
+    std::unique_lock<std::mutex> locker(state->lock);
+    state->finished.wait(locker, [&state](){ return state->running == 0; });
+    return state->err;
+}
@@ -0,0 +1,59 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <cstdint>
+
+struct hflat_priv;
+
+/* A fixed set of background threads running short tasks with a request context referring to the file system.
+ * Tasks still queued when the pool is stopped are discarded, running tasks are waited for. */
+class WorkerPool final
+{
+private:
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread>          workers;
+    bool                              shutdown;
+    std::mutex                        lock;
+    std::condition_variable           changed;
+
+public:
+    void start(struct hflat_priv *priv, std::size_t count);
+    void stop();
+
+    /* Queue a task. Returns false if the pool is not running. */
+    bool submit(const std::function<void()> &task);
+
+    /* Call fn(i) for i in [0, count), running up to window calls concurrently. The calling thread takes part, so
+     * that calls make progress even if all workers are busy. Returns the first error encountered, remaining calls
+     * are skipped after an error. */
+    int run(std::size_t count, std::size_t window, const std::function<int(std::size_t)> &fn);
+
+public:
+    explicit WorkerPool();
+    ~WorkerPool();
+    WorkerPool(const WorkerPool& rhs) = delete;
+    WorkerPool& operator=(const WorkerPool& rhs) = delete;
+};
+
+#endif /* WORKER_POOL_H_ */
@@ -0,0 +1,193 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "main.h"
+#include "debug.h"
+#include "metadata.pb.h"
+#include <thread>
+#include <algorithm>
+
+using namespace std::chrono;
+using kinetic::StatusCode;
+
+WriteLeases::WriteLeases(std::uint64_t duration_milliseconds) :
+        duration(duration_milliseconds), client_id(), held(), held_by_inode(), lock()
+{
+}
+
+WriteLeases::~WriteLeases()
+{
+}
+
+bool WriteLeases::enabled() const
+{
+    return duration.count() > 0;
+}
+
+void WriteLeases::setClientId(const std::string &id)
+{
+    client_id = id;
+}
+
+std::string WriteLeases::leaseKey(std::uint64_t inode_number, int blocknum)
+{
+    return "lease_" + std::to_string(inode_number) + "_" + std::to_string(blocknum);
+}
+
+/* Lease expiration is evaluated using the local clock of each client, clocks of clients are assumed to be
+ * reasonably synchronized. */
+std::int64_t WriteLeases::now() const
+{
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+/* A held lease that is about to expire is renewed early, so that a writer never loses its lease while
+ * buffering changes. */
+bool WriteLeases::heldLocally(const std::string &key, std::uint32_t start, std::uint32_t end)
+{
+    std::lock_guard<std::mutex> locker(lock);
+    if (!held.count(key))
+        return false;
+    for (auto &r : held[key])
+        if (r.start <= start && r.end >= end && r.expires - now() > duration.count() / 2)
+            return true;
+    return false;
+}
+
+int WriteLeases::acquire(std::uint64_t inode_number, int blocknum, std::uint32_t start, std::uint32_t end)
+{
+    if (!enabled())
+        return 0;
+
+    std::string key = leaseKey(inode_number, blocknum);
+    if (heldLocally(key, start, end))
+        return 0;
+
+    const std::int64_t deadline = now() + 2 * duration.count();
+    while (now() < deadline) {
+        unique_ptr<KineticRecord> record;
+        KineticStatus status = PRIV->kinetic->Get(key, record);
+        if (!status.ok() && status.statusCode() != StatusCode::REMOTE_NOT_FOUND) {
+            hflat_warning("status == %s", status.message().c_str());
+            return -EIO;
+        }
+
+        hflat::BlockLeases current;
+        if (status.ok() && !current.ParseFromString(*record->value()))
+            return -EINVAL;
+
+        /* Drop expired leases and detect overlapping leases of other clients. */
+        hflat::BlockLeases update;
+        std::vector<Range> own;
+        std::int64_t expires = now() + duration.count();
+        std::int64_t conflict_expires = 0;
+        for (auto &l : current.leases()) {
+            if (l.expires() <= now())
+                continue;
+            if (l.client() == client_id) {
+                own.push_back(Range { l.start(), l.end(), expires });
+                continue;
+            }
+            if (l.start() < end && start < l.end())
+                conflict_expires = std::max(conflict_expires, l.expires());
+            update.add_leases()->CopyFrom(l);
+        }
+
+        if (conflict_expires) {
+            hflat_debug("Range [%d,%d) of lease key %s is leased by another client, waiting.", start, end, key.c_str());
+            std::this_thread::sleep_for(milliseconds(std::min(conflict_expires - now() + 1, (std::int64_t) duration.count() / 4 + 1)));
+            continue;
+        }
+
+        /* Renew own leases, merging overlapping and adjacent ranges with the requested one. */
+        own.push_back(Range { start, end, expires });
+        std::sort(own.begin(), own.end(), [](const Range &a, const Range &b){ return a.start < b.start; });
+        std::vector<Range> merged;
+        for (auto &r : own) {
+            if (merged.size() && merged.back().end >= r.start)
+                merged.back().end = std::max(merged.back().end, r.end);
+            else
+                merged.push_back(r);
+        }
+        for (auto &r : merged) {
+            hflat::BlockLeases::Lease *l = update.add_leases();
+            l->set_client(client_id);
+            l->set_start(r.start);
+            l->set_end(r.end);
+            l->set_expires(r.expires);
+        }
+
+        std::string new_version = util::generate_version();
+        KineticRecord lease_record = util::serialized_record(update, new_version);
+        status = PRIV->kinetic->Put(key, status.ok() ? *record->version() : "", WriteMode::REQUIRE_SAME_VERSION, lease_record);
+        if (status.statusCode() == StatusCode::REMOTE_VERSION_MISMATCH)
+            continue;
+        if (!status.ok()) {
+            hflat_warning("status == %s", status.message().c_str());
+            return -EIO;
+        }
+
+        std::lock_guard<std::mutex> locker(lock);
+        held[key] = merged;
+        held_by_inode[inode_number].insert(key);
+        return 0;
+    }
+    hflat_warning("Failed acquiring lease for range [%d,%d) of lease key %s.", start, end, key.c_str());
+    return -EBUSY;
+}
+
+void WriteLeases::release(std::uint64_t inode_number)
+{
+    if (!enabled())
+        return;
+
+    std::unordered_set<std::string> keys;
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        if (!held_by_inode.count(inode_number))
+            return;
+        keys.swap(held_by_inode[inode_number]);
+        held_by_inode.erase(inode_number);
+        for (auto &key : keys)
+            held.erase(key);
+    }
+
+    /* Failing to release a lease is not an error, it will just expire. */
+    for (auto &key : keys) {
+        for (int attempt = 0; attempt < 5; attempt++) {
+            unique_ptr<KineticRecord> record;
+            KineticStatus status = PRIV->kinetic->Get(key, record);
+            if (!status.ok())
+                break;
+
+            hflat::BlockLeases current, update;
+            if (!current.ParseFromString(*record->value()))
+                break;
+            for (auto &l : current.leases())
+                if (l.client() != client_id && l.expires() > now())
+                    update.add_leases()->CopyFrom(l);
+
+            if (update.leases_size()) {
+                KineticRecord lease_record = util::serialized_record(update, util::generate_version());
+                status = PRIV->kinetic->Put(key, *record->version(), WriteMode::REQUIRE_SAME_VERSION, lease_record);
+            } else
+                status = PRIV->kinetic->Delete(key, *record->version(), WriteMode::REQUIRE_SAME_VERSION);
+
+            if (status.statusCode() != StatusCode::REMOTE_VERSION_MISMATCH)
+                break;
+        }
+    }
+}
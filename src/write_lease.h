@@ -0,0 +1,77 @@
+/* h-flat file system: Hierarchical Functionality in a Flat Namespace
+ * Copyright (c) 2014 Seagate
+ * Written by Paul Hermann Lensing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WRITE_LEASE_H_
+#define WRITE_LEASE_H_
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+/* Byte-range write leases for data blocks that are shared between clients.
+ *
+ * Leases of a data block are stored in a versioned lease key in the namespace. A client has to hold a lease
+ * covering a byte range before writing to it. Since leased ranges of different clients never overlap,
+ * concurrent writers of the same block only ever have to merge disjoint changes when flushing.
+ * Leases expire after the configured duration, so that leases of crashed clients do not block others. */
+class WriteLeases final
+{
+private:
+    struct Range
+    {
+        std::uint32_t start;
+        std::uint32_t end;
+        std::int64_t  expires;
+    };
+
+    std::chrono::milliseconds duration;
+    std::string               client_id;
+
+    /* leases held by this client: lease key -> ranges, inode number -> lease keys */
+    std::unordered_map<std::string, std::vector<Range>> held;
+    std::unordered_map<std::uint64_t, std::unordered_set<std::string>> held_by_inode;
+    std::mutex lock;
+
+private:
+    std::int64_t now() const;
+    bool heldLocally(const std::string &key, std::uint32_t start, std::uint32_t end);
+
+public:
+    /* Acquire a write lease for range [start,end) of the data block. Blocks while an overlapping lease is held by
+     * another client. Returns 0 on success, -EBUSY if a conflicting lease is not released in time. */
+    int acquire(std::uint64_t inode_number, int blocknum, std::uint32_t start, std::uint32_t end);
+
+    /* Release all leases held for the supplied inode. */
+    void release(std::uint64_t inode_number);
+
+    /* Key of the lease record for a data block. */
+    static std::string leaseKey(std::uint64_t inode_number, int blocknum);
+
+    bool enabled() const;
+    void setClientId(const std::string &id);
+
+public:
+    /* Set duration to 0 to disable write leases. */
+    explicit WriteLeases(std::uint64_t duration_milliseconds);
+    ~WriteLeases();
+    WriteLeases(const WriteLeases& rhs) = delete;
+    WriteLeases& operator=(const WriteLeases& rhs) = delete;
+};
+
+#endif /* WRITE_LEASE_H_ */